@@ -0,0 +1,148 @@
+#include <vector>
+#include <set>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+
+#include "../opts.h"
+
+// Compares exchange() with one MPI message per (from, to) block pair against
+// aggregation of all the queues bound for the same rank into a single message,
+// and against per-pair messages received into preposted receives.
+// Every block sends a small queue to its `neighbors` nearest blocks in a ring of gids.
+
+struct Block
+{
+  int                   sum;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+
+void send(void*, const diy::Master::ProxyWithLink& cp, void*)
+{
+  diy::Link*    l = cp.link();
+  for (int i = 0; i < l->size(); ++i)
+    cp.enqueue(l->target(i), cp.gid());
+}
+
+void receive(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  Block*        b = static_cast<Block*>(b_);
+  diy::Link*    l = cp.link();
+
+  b->sum = 0;
+  for (int i = 0; i < l->size(); ++i)
+  {
+    int x;
+    cp.dequeue(l->target(i).gid, x);
+    b->sum += x;
+  }
+}
+
+struct Check
+{
+  void operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*        b = static_cast<Block*>(b_);
+    diy::Link*    l = cp.link();
+    int expected = 0;
+    for (int i = 0; i < l->size(); ++i)
+      expected += l->target(i).gid;
+    if (b->sum != expected)
+      fprintf(stderr, "Error: block %d received %d, expected %d\n", cp.gid(), b->sum, expected);
+  }
+};
+
+double time_exchange(diy::Master& master, int iterations)
+{
+  master.communicator().barrier();
+  double start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+  {
+    master.foreach(&send);
+    master.exchange();
+    master.foreach(&receive);
+  }
+  master.foreach(Check());
+  return (MPI_Wtime() - start) / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 128*world.size();
+  int                       neighbors  = 26;
+  int                       iterations = 100;
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "neighbors",   neighbors,  "number of neighbors of each block")
+      >> Option('i', "iterations",  iterations, "number of exchanges")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::Master               master(world, 1, -1, &create_block, &destroy_block);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  // count the messages each scheme sends from this rank
+  long                      pairs = 0;
+  std::set<int>             procs;
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::Link*  link = new diy::Link;
+    for (int j = -neighbors/2; j <= neighbors/2; ++j)
+    {
+      if (j == 0) continue;
+
+      diy::BlockID  nbr;
+      nbr.gid  = (gids[i] + j + nblocks) % nblocks;
+      nbr.proc = assigner.rank(nbr.gid);
+      link->add_neighbor(nbr);
+      if (nbr.proc != world.rank())
+      {
+        ++pairs;
+        procs.insert(nbr.proc);
+      }
+    }
+    master.add(gids[i], new Block, link);
+  }
+
+  long                      pair_messages, packed_messages,
+                            local_packed = procs.size();
+  diy::mpi::all_reduce(world, pairs,        pair_messages,   std::plus<long>());
+  diy::mpi::all_reduce(world, local_packed, packed_messages, std::plus<long>());
+
+  master.set_aggregate(false);
+  double pair_time   = time_exchange(master, iterations);
+
+  master.set_prepost(true);
+  double prepost_time = time_exchange(master, iterations);
+  master.set_prepost(false);
+
+  master.set_aggregate(true);
+  double packed_time = time_exchange(master, iterations);
+
+  if (world.rank() == 0)
+  {
+    fprintf(stdout, "%d blocks, %d neighbors each, %d ranks\n", nblocks, neighbors, world.size());
+    fprintf(stdout, "per pair:   %8ld messages per exchange, %10.3f ms per iteration\n", pair_messages,   pair_time   * 1e3);
+    fprintf(stdout, "preposted:  %8ld messages per exchange, %10.3f ms per iteration\n", pair_messages,   prepost_time * 1e3);
+    fprintf(stdout, "aggregated: %8ld messages per exchange, %10.3f ms per iteration\n", packed_messages, packed_time * 1e3);
+  }
+}
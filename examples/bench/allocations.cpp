@@ -0,0 +1,185 @@
+#include <vector>
+#include <map>
+#include <set>
+#include <new>
+#include <cstdlib>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Counts the memory allocations per exchange in an iterative code that sends data of the same shape,
+// but with different keys, every round (a sparse map, a set, and a ragged array) to its two neighbors
+// in a ring, once dequeueing into fresh containers and once into containers kept in the block between rounds.
+
+static size_t allocations = 0;
+
+// the operators only forward to these, kept out of line, so that the compiler doesn't take
+// the free() of an inlined operator delete for the release of memory from a new expression
+void* allocate(size_t size) __attribute__((noinline));
+void  release(void* p)      __attribute__((noinline));
+
+void* allocate(size_t size)
+{
+  ++allocations;
+  void* p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void  release(void* p)                                  { std::free(p); }
+
+void* operator new(size_t size)                         { return allocate(size); }
+void  operator delete(void* p) throw()                  { release(p); }
+#if __cplusplus > 201103L           // C++14
+void  operator delete(void* p, size_t) throw()          { release(p); }
+#endif
+
+struct Neighbor
+{
+  std::map<int,float>               values;
+  std::set<int>                     indices;
+  std::vector< std::vector<int> >   rows;
+};
+
+struct Block
+{
+  Neighbor                          data[2];    // sent in alternate rounds
+  int                               round;
+  std::vector<Neighbor>             in;         // what was received from each neighbor in the last round
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+
+void send(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  Block*      b = static_cast<Block*>(b_);
+  diy::Link*  l = cp.link();
+  Neighbor&   data = b->data[b->round % 2];
+  for (int i = 0; i < l->size(); ++i)
+  {
+    cp.enqueue(l->target(i), data.values);
+    cp.enqueue(l->target(i), data.indices);
+    cp.enqueue(l->target(i), data.rows);
+  }
+}
+
+struct Receive
+{
+        Receive(bool reuse_): reuse(reuse_)     {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*      b = static_cast<Block*>(b_);
+    diy::Link*  l = cp.link();
+    Neighbor&   data = b->data[b->round++ % 2];     // all blocks are in the same round
+    b->in.resize(l->size());
+    for (int i = 0; i < l->size(); ++i)
+    {
+      Neighbor  fresh;
+      Neighbor& in = reuse ? b->in[i] : fresh;
+      cp.dequeue(l->target(i).gid, in.values);
+      cp.dequeue(l->target(i).gid, in.indices);
+      cp.dequeue(l->target(i).gid, in.rows);
+      if (in.values != data.values || in.indices != data.indices || in.rows != data.rows)
+        fprintf(stderr, "Error: block %d got the wrong data from %d\n", cp.gid(), l->target(i).gid);
+    }
+  }
+
+  bool  reuse;
+};
+
+// returns the allocations per exchange (send, exchange, receive) and per receive
+std::pair<double,double> count_allocations(diy::Master& master, bool reuse, int iterations)
+{
+  master.foreach(&send);            // warm up: the queues and the destinations get their capacity
+  master.exchange();
+  master.foreach(Receive(reuse));
+
+  size_t total = 0, receive = 0;
+  for (int i = 0; i < iterations; ++i)
+  {
+    size_t start = allocations;
+    master.foreach(&send);
+    master.exchange();
+    size_t received = allocations;
+    master.foreach(Receive(reuse));
+    receive += allocations - received;
+    total   += allocations - start;
+  }
+  return std::make_pair(double(total) / iterations, double(receive) / iterations);
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 4*world.size();
+  int                       size       = 10000;
+  int                       iterations = 10;
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "size",        size,       "number of elements in each container")
+      >> Option('i', "iterations",  iterations, "number of exchanges")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::Master               master(world, 1, -1, &create_block, &destroy_block);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::Link*  link = new diy::Link;
+    for (int j = -1; j <= 1; j += 2)
+    {
+      diy::BlockID  nbr;
+      nbr.gid  = (gids[i] + j + nblocks) % nblocks;
+      nbr.proc = assigner.rank(nbr.gid);
+      link->add_neighbor(nbr);
+    }
+
+    Block* b = new Block;
+    b->round = 0;
+    for (int r = 0; r < 2; ++r)
+    {
+      Neighbor& data = b->data[r];
+      for (int k = 0; k < size; ++k)
+      {
+        data.values[3*k + r]    = k;
+        data.indices.insert(5*k + r);
+      }
+      data.rows.resize(size / 10);
+      for (size_t k = 0; k < data.rows.size(); ++k)
+        data.rows[k].resize((k + r) % 16, k);
+    }
+    master.add(gids[i], b, link);
+  }
+
+  std::pair<double,double> fresh  = count_allocations(master, false, iterations);
+  std::pair<double,double> reused = count_allocations(master, true,  iterations);
+
+  if (world.rank() == 0)
+  {
+    fprintf(stdout, "%d blocks, %d elements per container, %d ranks; allocations on rank 0\n", nblocks, size, world.size());
+    fprintf(stdout, "fresh containers:    %12.1f per exchange, %12.1f in the receiving foreach\n", fresh.first,  fresh.second);
+    fprintf(stdout, "reused containers:   %12.1f per exchange, %12.1f in the receiving foreach\n", reused.first, reused.second);
+  }
+}
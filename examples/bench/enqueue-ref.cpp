@@ -0,0 +1,146 @@
+#include <vector>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Compares enqueueing a copy of a large field with enqueueing a reference to it
+// (Proxy::enqueue_ref()), which the exchange sends as a gather straight from the field.
+// Every block sends its field to its two neighbors in a ring, between a header and a footer.
+
+struct Block
+{
+  std::vector<float>    field;
+  float                 received;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, static_cast<const Block*>(b)->field); diy::save(bb, static_cast<const Block*>(b)->received); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, static_cast<Block*>(b)->field);       diy::load(bb, static_cast<Block*>(b)->received); }
+
+struct Send
+{
+        Send(bool reference_): reference(reference_)            {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*      b = static_cast<Block*>(b_);
+    diy::Link*  l = cp.link();
+    for (int i = 0; i < l->size(); ++i)
+    {
+      cp.enqueue(l->target(i), cp.gid());
+      if (reference)
+        cp.enqueue_ref(l->target(i), &b->field[0], b->field.size());
+      else
+        cp.enqueue(l->target(i), &b->field[0], b->field.size());
+      cp.enqueue(l->target(i), -cp.gid());
+    }
+  }
+
+  bool  reference;
+};
+
+void receive(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  Block*        b = static_cast<Block*>(b_);
+  diy::Link*    l = cp.link();
+
+  std::vector<float> in(b->field.size());
+  b->received = 0;
+  for (int i = 0; i < l->size(); ++i)
+  {
+    int from = l->target(i).gid, header, footer;
+    cp.dequeue(from, header);
+    cp.dequeue(from, &in[0], in.size());
+    cp.dequeue(from, footer);
+    if (header != from || footer != -from || in.back() != from)
+      fprintf(stderr, "Error: block %d got %d, %d, %f from %d\n", cp.gid(), header, footer, in.back(), from);
+    b->received += in.back();
+  }
+}
+
+double time_exchange(diy::Master& master, bool reference, int iterations)
+{
+  master.communicator().barrier();
+  double start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+  {
+    master.foreach(Send(reference));
+    master.exchange();
+    master.foreach(&receive);
+  }
+  return (MPI_Wtime() - start) / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 4*world.size();
+  int                       size       = 1 << 20;
+  int                       iterations = 10;
+  int                       in_memory  = -1;
+  int                       threads    = 1;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  bool                      aggregate  = ops >> Present('a', "aggregate", "send one message per rank");
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "size",        size,       "number of floats in each block's field")
+      >> Option('i', "iterations",  iterations, "number of exchanges")
+      >> Option('m', "memory",      in_memory,  "maximum blocks to store in memory")
+      >> Option('t', "threads",     threads,    "number of threads")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::FileStorage          storage(prefix);
+  diy::Master               master(world, threads, in_memory,
+                                   &create_block, &destroy_block,
+                                   &storage, &save_block, &load_block);
+  master.set_aggregate(aggregate);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::Link*  link = new diy::Link;
+    for (int j = -1; j <= 1; j += 2)
+    {
+      diy::BlockID  nbr;
+      nbr.gid  = (gids[i] + j + nblocks) % nblocks;
+      nbr.proc = assigner.rank(nbr.gid);
+      link->add_neighbor(nbr);
+    }
+
+    Block* b = new Block;
+    b->field.resize(size, gids[i]);
+    master.add(gids[i], b, link);
+  }
+
+  double copy_time = time_exchange(master, false, iterations);
+  double ref_time  = time_exchange(master, true,  iterations);
+
+  if (world.rank() == 0)
+  {
+    fprintf(stdout, "%d blocks, %d floats each, %d ranks\n", nblocks, size, world.size());
+    fprintf(stdout, "copy:      %10.3f ms per iteration\n", copy_time * 1e3);
+    fprintf(stdout, "reference: %10.3f ms per iteration\n", ref_time  * 1e3);
+  }
+}
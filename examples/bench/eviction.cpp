@@ -0,0 +1,155 @@
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Counts the blocks reloaded from external storage under different eviction policies
+// (Master::set_eviction_policy()), in two access patterns:
+//   window: consecutive foreach calls process a window of (local) blocks that slides by one block each time;
+//   hot:    every foreach processes the same few large (expensive to load) blocks and a rotating pair of small ones.
+
+struct Block
+{
+  std::vector<double>   field;
+  double                sum;
+};
+
+diy::critical_resource<int>     loads(0);
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, static_cast<const Block*>(b)->field); diy::save(bb, static_cast<const Block*>(b)->sum); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, static_cast<Block*>(b)->field);       diy::load(bb, static_cast<Block*>(b)->sum); ++*loads.access(); }
+
+void  compute(void* b_, const diy::Master::ProxyWithLink&, void*)
+{
+  Block* b = static_cast<Block*>(b_);
+  if (!b)
+    return;
+  for (size_t i = 0; i < b->field.size(); ++i)
+    b->sum += std::sqrt(b->field[i]);
+}
+
+struct Window
+{
+        Window(int first_, int size_, int nblocks_):
+          first(first_), size(size_), nblocks(nblocks_)         {}
+
+  bool  operator()(int i, const diy::Master&) const            { return (i - first + nblocks) % nblocks >= size; }
+
+  int   first, size, nblocks;
+};
+
+struct Hot
+{
+        Hot(int round_, int nhot_, int nblocks_):
+          round(round_), nhot(nhot_), nblocks(nblocks_)         {}
+
+  bool  operator()(int i, const diy::Master&) const
+  {
+    if (i < nhot)
+      return false;
+    int cold = nblocks - nhot;
+    return (i - nhot + 2*(cold - round % cold)) % cold >= 2;
+  }
+
+  int   round, nhot, nblocks;
+};
+
+diy::Master::EvictionPolicy*    make_policy(int p)
+{
+  switch (p)
+  {
+    case 1:  return new diy::Master::LRUEviction;
+    case 2:  return new diy::Master::CostAwareEviction;
+    case 3:  return new diy::Master::LRUEviction(true);
+    default: return 0;
+  }
+}
+
+const char* policy_names[] = { "unload all", "LRU", "cost-aware", "shared LRU" };
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 16;
+  int                       size       = 1 << 16;
+  int                       rounds     = 32;
+  int                       in_memory  = 4;
+  int                       threads    = 1;
+  int                       nhot       = 2;
+  int                       hot_factor = 8;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks per rank")
+      >> Option('n', "size",        size,       "number of doubles in a small block's field")
+      >> Option('r', "rounds",      rounds,     "number of foreach calls in each pattern")
+      >> Option('m', "memory",      in_memory,  "maximum blocks to store in memory")
+      >> Option('t', "threads",     threads,    "number of threads")
+      >> Option(     "hot",         nhot,       "number of large blocks in the hot pattern")
+      >> Option(     "factor",      hot_factor, "how many times larger the large blocks are")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  if (world.rank() == 0)
+    fprintf(stdout, "%d blocks of %d doubles (%d of them %dx larger in the hot pattern), %d in memory, %d threads, %d ranks\n",
+                    nblocks, size, nhot, hot_factor, in_memory, threads, world.size());
+
+  for (int pattern = 0; pattern < 2; ++pattern)
+    for (int p = 0; p < 4; ++p)
+    {
+      diy::FileStorage          storage(prefix);
+      diy::Master               master(world, threads, in_memory,
+                                       &create_block, &destroy_block,
+                                       &storage,
+                                       &save_block, &load_block);
+      master.set_eviction_policy(make_policy(p));
+      diy::ContiguousAssigner   assigner(world.size(), nblocks * world.size());
+
+      std::vector<int> gids;
+      assigner.local_gids(world.rank(), gids);
+      for (unsigned i = 0; i < gids.size(); ++i)
+      {
+        Block* b = new Block;
+        int    n = (pattern == 1 && (int) i < nhot) ? size * hot_factor : size;
+        b->field.resize(n, gids[i]);
+        b->sum = 0;
+        master.add(gids[i], b, new diy::Link);
+      }
+
+      *loads.access() = 0;
+      world.barrier();
+      double start = MPI_Wtime();
+      for (int r = 0; r < rounds; ++r)
+        if (pattern == 0)
+          master.foreach(&compute, Window(r % nblocks, in_memory, nblocks));
+        else
+          master.foreach(&compute, Hot(r, nhot, nblocks));
+      double time = MPI_Wtime() - start;
+      world.barrier();
+
+      if (world.rank() == 0)
+        fprintf(stdout, "%-6s %-12s %6d loads, %10.3f ms per foreach\n",
+                        pattern == 0 ? "window" : "hot", policy_names[p],
+                        *loads.access(), time / rounds * 1e3);
+    }
+}
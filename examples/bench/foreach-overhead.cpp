@@ -0,0 +1,120 @@
+#include <vector>
+#include <deque>
+#include <list>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+
+#include "../opts.h"
+
+// Measures the per-call overhead of Master::foreach() with tiny blocks, next to
+// the previous scheme, which launched and joined the threads on every call and
+// handed out the blocks through a single shared counter.
+
+struct Block
+{
+  int                   value;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+
+void increment(void* b_, const diy::Master::ProxyWithLink&, void*)
+{
+  Block* b = static_cast<Block*>(b_);
+  ++b->value;
+}
+
+// The foreach() of old: spawn num_threads threads; each grabs the next block from a shared counter
+struct SpawnProcessBlock
+{
+            SpawnProcessBlock(diy::Master& master_, diy::critical_resource<int>& idx_):
+                master(master_), idx(idx_)      {}
+
+  void      process()
+  {
+    while (true)
+    {
+      int cur = (*idx.access())++;
+      if (cur >= (int) master.size())
+        return;
+      increment(master.block(cur), master.proxy(cur), 0);
+    }
+  }
+
+  static void run(void* bf)                 { static_cast<SpawnProcessBlock*>(bf)->process(); }
+
+  diy::Master&                  master;
+  diy::critical_resource<int>&  idx;
+};
+
+void spawn_foreach(diy::Master& master, int num_threads)
+{
+  diy::critical_resource<int> idx(0);
+  std::list<diy::thread*>     threads;
+  SpawnProcessBlock           bf(master, idx);
+  for (int i = 0; i < num_threads; ++i)
+    threads.push_back(new diy::thread(&SpawnProcessBlock::run, &bf));
+  for (std::list<diy::thread*>::iterator it = threads.begin(); it != threads.end(); ++it)
+  {
+    (*it)->join();
+    delete *it;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 64*world.size();
+  int                       threads    = 4;
+  int                       iterations = 1000;
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('t', "thread",      threads,    "number of threads")
+      >> Option('i', "iterations",  iterations, "number of foreach calls")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::Master               master(world, threads, -1, &create_block, &destroy_block);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    Block* b = new Block; b->value = 0;
+    master.add(gids[i], b, new diy::Link);
+  }
+
+  world.barrier();
+  double start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+    spawn_foreach(master, threads);
+  double spawn_time = MPI_Wtime() - start;
+
+  world.barrier();
+  start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+    master.foreach(&increment);
+  double pool_time = MPI_Wtime() - start;
+
+  if (world.rank() == 0)
+  {
+    fprintf(stdout, "%d local blocks, %d threads, %d iterations\n", (int) master.size(), threads, iterations);
+    fprintf(stdout, "spawn threads per call:   %10.3f us/call\n", spawn_time / iterations * 1e6);
+    fprintf(stdout, "persistent pool:          %10.3f us/call\n", pool_time  / iterations * 1e6);
+  }
+}
@@ -0,0 +1,220 @@
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/serialization.hpp>
+#include <diy/quantization.hpp>
+
+#include "../opts.h"
+
+// Compares error-bounded lossy encoding of float fields (Proxy::enqueue_lossy()) with raw transfer.
+// First reports, for a smooth and a noisy field and several tolerances, the compression ratio,
+// the encoding and decoding throughput, and the largest error. Then times an exchange in which
+// every block sends its field to its two neighbors in a ring, raw and with each tolerance.
+
+struct Block
+{
+  std::vector<float>    field;
+  float                 error;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+
+void fill(std::vector<float>& field, int seed, bool noisy)
+{
+  srand(seed);
+  for (size_t i = 0; i < field.size(); ++i)
+  {
+    double t = double(i) / field.size();
+    field[i] = float(std::sin(20*t + seed) + .5*std::cos(130*t));
+    if (noisy)
+      field[i] += float(.01 * (double(rand()) / RAND_MAX - .5));
+  }
+}
+
+double max_error(const std::vector<float>& x, const std::vector<float>& y)
+{
+  double err = 0;
+  for (size_t i = 0; i < x.size(); ++i)
+    err = std::max(err, std::fabs(double(x[i]) - double(y[i])));
+  return err;
+}
+
+void report(const char* name, const std::vector<float>& field, double tolerance, int iterations)
+{
+  diy::MemoryBuffer     bb;
+  std::vector<float>    out;
+
+  double start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+  {
+    bb.reset();
+    if (tolerance < 0)
+      diy::save(bb, field);
+    else
+      diy::save_quantized(bb, field, tolerance);
+  }
+  double save_time = MPI_Wtime() - start;
+
+  start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+  {
+    bb.reset();
+    if (tolerance < 0)
+      diy::load(bb, out);
+    else
+      diy::load_quantized(bb, out);
+  }
+  double load_time = MPI_Wtime() - start;
+
+  double mb_raw = double(field.size() * sizeof(float)) * iterations / (1 << 20);
+  char   tol[32];
+  if (tolerance < 0)
+    sprintf(tol, "raw");
+  else
+    sprintf(tol, "%g", tolerance);
+  fprintf(stdout, "%-7s %-6s  ratio: %6.2f   save: %8.1f MB/s   load: %8.1f MB/s   max error: %g\n",
+                  name, tol, double(field.size() * sizeof(float)) / bb.size(),
+                  mb_raw / save_time, mb_raw / load_time, max_error(field, out));
+}
+
+struct Send
+{
+        Send(double tolerance_): tolerance(tolerance_)          {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*      b = static_cast<Block*>(b_);
+    diy::Link*  l = cp.link();
+    for (int i = 0; i < l->size(); ++i)
+      if (tolerance < 0)
+        cp.enqueue(l->target(i), b->field);
+      else
+        cp.enqueue_lossy(l->target(i), b->field, tolerance);
+  }
+
+  double tolerance;
+};
+
+struct Receive
+{
+        Receive(double tolerance_): tolerance(tolerance_)       {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*      b = static_cast<Block*>(b_);
+    diy::Link*  l = cp.link();
+
+    std::vector<float>  in, expected(b->field.size());
+    b->error = 0;
+    for (int i = 0; i < l->size(); ++i)
+    {
+      int from = l->target(i).gid;
+      if (tolerance < 0)
+        cp.dequeue(from, in);
+      else
+        cp.dequeue_lossy(from, in);
+      fill(expected, from, false);
+      b->error = std::max(b->error, float(max_error(expected, in)));
+    }
+    if (tolerance >= 0 && b->error > tolerance)
+      fprintf(stderr, "Error: block %d received values off by %g > %g\n", cp.gid(), b->error, tolerance);
+  }
+
+  double tolerance;
+};
+
+double time_exchange(diy::Master& master, double tolerance, int iterations)
+{
+  master.communicator().barrier();
+  double start = MPI_Wtime();
+  for (int i = 0; i < iterations; ++i)
+  {
+    master.foreach(Send(tolerance));
+    master.exchange();
+    master.foreach(Receive(tolerance));
+  }
+  return (MPI_Wtime() - start) / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 4*world.size();
+  int                       size       = 1 << 20;
+  int                       iterations = 10;
+  int                       threads    = 1;
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "size",        size,       "number of floats in each block's field")
+      >> Option('i', "iterations",  iterations, "number of repetitions")
+      >> Option('t', "threads",     threads,    "number of threads")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  double tolerances[] = { -1, 1e-2, 1e-4, 1e-6 };      // -1 = raw
+  int    ntolerances  = sizeof(tolerances) / sizeof(double);
+
+  if (world.rank() == 0)
+  {
+    std::vector<float> smooth(size), noisy(size);
+    fill(smooth, 0, false);
+    fill(noisy,  0, true);
+    for (int i = 0; i < ntolerances; ++i)
+      report("smooth", smooth, tolerances[i], iterations);
+    for (int i = 0; i < ntolerances; ++i)
+      report("noisy",  noisy,  tolerances[i], iterations);
+  }
+
+  diy::Master               master(world, threads, -1, &create_block, &destroy_block);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::Link*  link = new diy::Link;
+    for (int j = -1; j <= 1; j += 2)
+    {
+      diy::BlockID  nbr;
+      nbr.gid  = (gids[i] + j + nblocks) % nblocks;
+      nbr.proc = assigner.rank(nbr.gid);
+      link->add_neighbor(nbr);
+    }
+
+    Block* b = new Block;
+    b->field.resize(size);
+    fill(b->field, gids[i], false);
+    master.add(gids[i], b, link);
+  }
+
+  if (world.rank() == 0)
+    fprintf(stdout, "exchange: %d blocks, %d floats each, %d ranks\n", nblocks, size, world.size());
+  for (int i = 0; i < ntolerances; ++i)
+  {
+    double time = time_exchange(master, tolerances[i], iterations);
+    if (world.rank() == 0)
+    {
+      if (tolerances[i] < 0)
+        fprintf(stdout, "raw:            %10.3f ms per iteration\n", time * 1e3);
+      else
+        fprintf(stdout, "tolerance %-5g %10.3f ms per iteration\n", tolerances[i], time * 1e3);
+    }
+  }
+}
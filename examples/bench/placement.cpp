@@ -0,0 +1,114 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/thread.hpp>
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Times moving records out to external storage and back from several threads at once, with the files
+// in a slow directory, in a fast one, or in both (the placement chooses; the slow directory is listed first).
+
+struct Job
+{
+  diy::ExternalStorage*     storage;
+  size_t                    size;
+  int                       count;
+};
+
+void  run(void* j)
+{
+  Job&                      job = *static_cast<Job*>(j);
+  std::vector<int>          ids(job.count);
+  for (int i = 0; i < job.count; ++i)
+  {
+    diy::MemoryBuffer bb;
+    bb.buffer.resize(job.size, char(i));
+    ids[i] = job.storage->put(bb);
+  }
+  for (int i = 0; i < job.count; ++i)
+  {
+    diy::MemoryBuffer bb;
+    job.storage->get(ids[i], bb, 0);
+  }
+}
+
+double      time_storage(diy::ExternalStorage& storage, size_t size, int count, int threads)
+{
+  std::vector<Job>              jobs(threads);
+  std::vector<diy::thread*>     workers;
+  double start = MPI_Wtime();
+  for (int t = 0; t < threads; ++t)
+  {
+    jobs[t].storage = &storage;
+    jobs[t].size    = size;
+    jobs[t].count   = count;
+    if (t > 0)
+      workers.push_back(new diy::thread(&run, &jobs[t]));
+  }
+  run(&jobs[0]);
+  for (size_t t = 0; t < workers.size(); ++t)
+  {
+    workers[t]->join();
+    delete workers[t];
+  }
+  return MPI_Wtime() - start;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  size_t                    size       = 1 << 16;
+  int                       count      = 200;
+  int                       threads    = 4;
+  std::string               slow       = "/tmp";
+  std::string               fast       = "/dev/shm";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('s', "size",        size,       "bytes in each record")
+      >> Option('c', "count",       count,      "records each thread moves out and back")
+      >> Option('t', "threads",     threads,    "number of threads")
+      >> Option(     "slow",        slow,       "slow directory")
+      >> Option(     "fast",        fast,       "fast directory")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  std::vector<std::string>  both;
+  both.push_back(slow + "/DIY.XXXXXX");
+  both.push_back(fast + "/DIY.XXXXXX");
+
+  fprintf(stdout, "%d threads, %d records of %lu bytes each\n", threads, count, size);
+  for (int spill = 0; spill < 2; ++spill)
+  {
+    const char* names[] = { "slow", "fast", "both" };
+    for (int d = 0; d < 3; ++d)
+    {
+      std::vector<std::string> templates;
+      if (d == 2)
+        templates = both;
+      else
+        templates.push_back(both[d]);
+
+      diy::FileStorage      file_storage(templates);
+      diy::SpillStorage     spill_storage(templates);
+      double time = time_storage(spill ? (diy::ExternalStorage&) spill_storage : file_storage, size, count, threads);
+      fprintf(stdout, "%-12s %-4s: %10.3f ms, %8.1f MB/s\n",
+                      spill ? "SpillStorage" : "FileStorage", names[d],
+                      time * 1e3, 2. * threads * count * size / time / 1e6);
+    }
+  }
+}
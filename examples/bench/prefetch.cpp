@@ -0,0 +1,123 @@
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Measures how long foreach stalls on loading blocks stored out of core, with and without
+// prefetching (Master::set_prefetch()). Every block holds a field, which the foreach passes
+// over a few times; the stall time is the time of the foreach minus the time spent computing.
+
+struct Block
+{
+  std::vector<double>   field;
+  double                sum;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, static_cast<const Block*>(b)->field); diy::save(bb, static_cast<const Block*>(b)->sum); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, static_cast<Block*>(b)->field);       diy::load(bb, static_cast<Block*>(b)->sum); }
+
+struct Compute
+{
+        Compute(int passes_, diy::critical_resource<double>& time_):
+          passes(passes_), time(time_)                          {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink&, void*) const
+  {
+    Block*  b     = static_cast<Block*>(b_);
+    double  start = MPI_Wtime();
+    for (int p = 0; p < passes; ++p)
+      for (size_t i = 0; i < b->field.size(); ++i)
+        b->sum += std::sqrt(b->field[i] + p);
+    *time.access() += MPI_Wtime() - start;
+  }
+
+  int                                   passes;
+  diy::critical_resource<double>&       time;
+};
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 16;
+  int                       size       = 1 << 20;
+  int                       iterations = 3;
+  int                       in_memory  = 4;
+  int                       threads    = 1;
+  int                       passes     = 4;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  bool                      direct     = ops >> Present('d', "direct", "store the blocks in a SpillStorage that bypasses the page cache");
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "size",        size,       "number of doubles in each block's field")
+      >> Option('i', "iterations",  iterations, "number of foreach calls to time")
+      >> Option('m', "memory",      in_memory,  "maximum blocks to store in memory")
+      >> Option('t', "threads",     threads,    "number of threads")
+      >> Option('w', "work",        passes,     "passes over each field in the foreach")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::FileStorage          file_storage(prefix);
+  diy::SpillStorage         spill_storage(prefix, true);
+  diy::Master               master(world, threads, in_memory,
+                                   &create_block, &destroy_block,
+                                   direct ? (diy::ExternalStorage*) &spill_storage : &file_storage,
+                                   &save_block, &load_block);
+  diy::RoundRobinAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    Block* b = new Block;
+    b->field.resize(size, gids[i]);
+    b->sum = 0;
+    master.add(gids[i], b, new diy::Link);
+  }
+
+  if (world.rank() == 0)
+    fprintf(stdout, "%d blocks of %d doubles, %d in memory, %d threads, %d ranks\n",
+                    nblocks, size, in_memory, threads, world.size());
+
+  int max_prefetch = std::max(1, in_memory / threads - 1);
+  for (int prefetch = 0; prefetch <= std::min(2, max_prefetch); ++prefetch)
+  {
+    master.set_prefetch(prefetch);
+    diy::critical_resource<double>  compute_time(0);
+
+    master.foreach(Compute(passes, compute_time));     // warm up
+    *compute_time.access() = 0;
+
+    world.barrier();
+    double start = MPI_Wtime();
+    for (int i = 0; i < iterations; ++i)
+      master.foreach(Compute(passes, compute_time));
+    double total   = (MPI_Wtime() - start) / iterations;
+    double compute = *compute_time.access() / iterations / threads;
+
+    if (world.rank() == 0)
+      fprintf(stdout, "prefetch %d: %10.3f ms per foreach, %10.3f ms computing, %10.3f ms stalled\n",
+                      prefetch, total * 1e3, compute * 1e3, (total - compute) * 1e3);
+  }
+}
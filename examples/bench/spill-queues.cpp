@@ -0,0 +1,130 @@
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <sys/resource.h>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Measures the time and the peak memory of a foreach in which every block enqueues a large queue
+// to a block on the next rank, with one block in memory at a time, so that the outgoing queues
+// are moved to external storage as each block is unloaded, and read back for the exchange.
+// Run on at least two ranks: queues to blocks on the same rank are not moved out this way.
+
+struct Block
+{
+  int                   value;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, *static_cast<const Block*>(b)); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, *static_cast<Block*>(b)); }
+
+struct Enqueue
+{
+        Enqueue(size_t size_): size(size_)      {}
+
+  void  operator()(void*, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    std::vector<char> piece(1 << 20, char(cp.gid()));       // in pieces, so that the queue is the only large buffer
+    for (size_t sent = 0; sent < size; sent += piece.size())
+      cp.enqueue(cp.link()->target(0), &piece[0], std::min(piece.size(), size - sent));
+  }
+
+  size_t    size;
+};
+
+void  dequeue(void*, const diy::Master::ProxyWithLink& cp, void*)
+{
+  std::vector<int> in;
+  cp.incoming(in);
+  for (unsigned i = 0; i < in.size(); ++i)
+  {
+    std::vector<char> piece(1 << 20);
+    while (cp.incoming(in[i]))
+    {
+      size_t n = std::min(piece.size(), cp.incoming(in[i]).buffer.size() - cp.incoming(in[i]).position);
+      cp.dequeue(in[i], &piece[0], n);
+    }
+  }
+}
+
+long  peak_kb()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 4;
+  size_t                    size       = 1 << 26;
+  bool                      spill      = false;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  spill = ops >> Present('l', "spill", "use a SpillStorage instead of a FileStorage");
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks per rank")
+      >> Option('s', "size",        size,       "bytes each block enqueues")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::FileStorage          file_storage(prefix);
+  diy::SpillStorage         spill_storage(prefix);
+  diy::Master               master(world, 1, 1,
+                                   &create_block, &destroy_block,
+                                   spill ? (diy::ExternalStorage*) &spill_storage : &file_storage,
+                                   &save_block, &load_block);
+  diy::ContiguousAssigner   assigner(world.size(), nblocks * world.size());
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::BlockID  nbr;
+    nbr.gid  = (gids[i] + nblocks) % (nblocks * world.size());
+    nbr.proc = assigner.rank(nbr.gid);
+    diy::Link*    link = new diy::Link;
+    link->add_neighbor(nbr);
+    Block* b = new Block;
+    b->value = gids[i];
+    master.add(gids[i], b, link);
+  }
+
+  long before = peak_kb();
+  world.barrier();
+  double start = MPI_Wtime();
+  master.foreach(Enqueue(size));
+  double enqueued = MPI_Wtime();
+  long   unloaded = peak_kb();
+  master.exchange();
+  master.foreach(&dequeue);
+  world.barrier();
+  double end = MPI_Wtime();
+
+  long peak = peak_kb();
+  if (world.rank() == 0)
+    fprintf(stdout, "%d blocks per rank, %lu bytes each: foreach %8.3f ms, total %8.3f ms; peak memory above the start: %.1f MiB in the foreach, %.1f MiB overall\n",
+                    nblocks, size, (enqueued - start) * 1e3, (end - start) * 1e3, (unloaded - before) / 1024., (peak - before) / 1024.);
+}
@@ -0,0 +1,106 @@
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/mmap-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Times moving records out to external storage and back, for every storage backend:
+// queues (put() and get() of a MemoryBuffer) and blocks (put() and get() with save and load functions).
+
+typedef     std::vector<double>     Block;
+
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, *static_cast<const Block*>(b)); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, *static_cast<Block*>(b)); }
+
+// puts `count` records of `size` bytes, gets them back, and returns the time per record
+double      time_storage(diy::ExternalStorage& storage, size_t size, int count, bool blocks)
+{
+  Block                 block(size / sizeof(double), 1.);
+  std::vector<int>      ids(count);
+
+  double start = MPI_Wtime();
+  for (int i = 0; i < count; ++i)
+  {
+    if (blocks)
+      ids[i] = storage.put(&block, &save_block);
+    else
+    {
+      diy::MemoryBuffer bb;
+      diy::save(bb, block);
+      ids[i] = storage.put(bb);
+    }
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    if (blocks)
+      storage.get(ids[i], &block, &load_block);
+    else
+    {
+      diy::MemoryBuffer bb;
+      storage.get(ids[i], bb, 0);
+      diy::load(bb, block);
+    }
+  }
+  return (MPI_Wtime() - start) / count;
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  size_t                    max_size   = 1 << 22;
+  size_t                    total      = 1 << 28;
+  int                       rounds     = 3;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('s', "size",        max_size,   "largest record, in bytes")
+      >> Option('v', "volume",      total,      "bytes to move out and back for each record size (at most 1000 records)")
+      >> Option('r', "rounds",      rounds,     "number of times to repeat every measurement (the best is reported)")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::FileStorage          file_storage(prefix);
+  diy::SpillStorage         spill_storage(prefix);
+  diy::MmapStorage          mmap_storage(prefix);
+  diy::ExternalStorage*     storages[] = { &file_storage, &spill_storage, &mmap_storage };
+
+  fprintf(stdout, "%10s %8s %14s %14s %14s   (us per record, put and get)\n", "size", "records", "FileStorage", "SpillStorage", "MmapStorage");
+  for (int blocks = 0; blocks < 2; ++blocks)
+  {
+    fprintf(stdout, "%s\n", blocks ? "blocks (save and load functions)" : "queues (MemoryBuffer)");
+    for (size_t size = 1 << 10; size <= max_size; size *= 4)
+    {
+      int count = std::max(size_t(1), std::min(size_t(1000), total / size));
+      fprintf(stdout, "%10lu %8d", size, count);
+      for (int s = 0; s < 3; ++s)
+      {
+        double best = 0;
+        for (int r = 0; r < rounds; ++r)
+        {
+          double t = time_storage(*storages[s], size, count, blocks);
+          if (r == 0 || t < best)
+            best = t;
+        }
+        fprintf(stdout, " %14.2f", best * 1e6);
+      }
+      fprintf(stdout, "\n");
+    }
+  }
+}
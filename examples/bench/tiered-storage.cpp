@@ -0,0 +1,119 @@
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/compressed-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Times foreach over blocks that don't all fit in memory, when the blocks moved out of core go to disk
+// (a SpillStorage), or to a CompressedStorage in memory, with the SpillStorage behind it for the blocks
+// that exceed its budget. The budget is given as a fraction of the (uncompressed) size of the blocks.
+
+struct Block
+{
+  std::vector<double>   field;
+  double                sum;
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, static_cast<const Block*>(b)->field); diy::save(bb, static_cast<const Block*>(b)->sum); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, static_cast<Block*>(b)->field);       diy::load(bb, static_cast<Block*>(b)->sum); }
+
+void  compute(void* b_, const diy::Master::ProxyWithLink&, void*)
+{
+  Block* b = static_cast<Block*>(b_);
+  for (size_t i = 0; i < b->field.size(); ++i)
+    b->sum += b->field[i];
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 32;
+  int                       size       = 1 << 18;
+  int                       iterations = 4;
+  int                       in_memory  = 8;
+  int                       levels     = 1000;
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks per rank")
+      >> Option('n', "size",        size,       "number of doubles in each block's field")
+      >> Option('i', "iterations",  iterations, "number of foreach calls to time")
+      >> Option('m', "memory",      in_memory,  "maximum blocks to store in memory")
+      >> Option('l', "levels",      levels,     "number of distinct values in the field (0 = any)")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  size_t bytes = size_t(nblocks) * size * sizeof(double);
+  if (world.rank() == 0)
+    fprintf(stdout, "%d blocks of %d doubles (%.1f MiB) per rank, %d in memory, %d ranks\n",
+                    nblocks, size, bytes / 1048576., in_memory, world.size());
+
+  diy::LZCodec              codec(sizeof(double));
+  double                    fractions[] = { -1, 0, .25, .5, 1 };        // -1: no compressed tier
+  for (int f = 0; f < 5; ++f)
+  {
+    diy::SpillStorage         disk(prefix);
+    diy::CompressedStorage    compressed(size_t(fractions[f] * bytes), &disk, &codec);
+    diy::Master               master(world, 1, in_memory,
+                                     &create_block, &destroy_block,
+                                     fractions[f] < 0 ? (diy::ExternalStorage*) &disk : &compressed,
+                                     &save_block, &load_block);
+    diy::ContiguousAssigner   assigner(world.size(), nblocks * world.size());
+
+    std::vector<int> gids;
+    assigner.local_gids(world.rank(), gids);
+    for (unsigned i = 0; i < gids.size(); ++i)
+    {
+      Block* b = new Block;
+      b->field.resize(size);
+      for (int j = 0; j < size; ++j)
+      {
+        double x = std::sin(.001 * j + gids[i]);
+        b->field[j] = levels > 0 ? std::floor(x * levels) / levels : x;
+      }
+      b->sum = 0;
+      master.add(gids[i], b, new diy::Link);
+    }
+
+    master.foreach(&compute);       // warm up
+
+    world.barrier();
+    double start = MPI_Wtime();
+    for (int i = 0; i < iterations; ++i)
+      master.foreach(&compute);
+    world.barrier();
+    double time = (MPI_Wtime() - start) / iterations;
+
+    if (world.rank() == 0)
+    {
+      if (fractions[f] < 0)
+        fprintf(stdout, "disk only:               %10.3f ms per foreach\n", time * 1e3);
+      else
+        fprintf(stdout, "compressed, budget %4.2f: %10.3f ms per foreach, ratio %5.2f, %6lu hits, %6lu misses, %6lu overflows\n",
+                        fractions[f], time * 1e3,
+                        compressed.current_size() ? double(compressed.original_size()) / compressed.current_size() : 0.,
+                        compressed.hits(), compressed.misses(), compressed.overflows());
+    }
+  }
+}
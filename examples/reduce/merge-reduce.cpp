@@ -75,8 +75,7 @@ void sum(void* b_, const diy::ReduceProxy& rp, const diy::RegularMergePartners&
           continue;
       }
 
-      std::vector<int>    in_vals;
-      rp.dequeue(nbr_gid, in_vals);
+      diy::ArrayView<int> in_vals = rp.dequeue_view<int>(nbr_gid);     // read in place, without a copy
       fprintf(stderr, "[%d:%d] Received %d values from [%d]\n", rp.gid(), round, (int)in_vals.size(), nbr_gid);
       for (size_t j = 0; j < in_vals.size(); ++j)
         (b->data)[j] += in_vals[j];
@@ -1,8 +1,12 @@
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 #include <diy/mpi.hpp>
 #include <diy/master.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/mmap-storage.hpp>
+#include <diy/compressed-storage.hpp>
 #include <diy/assigner.hpp>
 #include <diy/serialization.hpp>
 
@@ -34,6 +38,13 @@ void local_average(void* b_, const diy::Master::ProxyWithLink& cp, void*)
   cp.all_reduce(total, std::plus<int>());
 }
 
+// Work that doesn't depend on the neighbors; can overlap with the exchange
+void local_work(void* b_, const diy::Master::ProxyWithLink&, void*)
+{
+  Block*        b = static_cast<Block*>(b_);
+  std::sort(b->values.begin(), b->values.end());
+}
+
 // Average the values received from the neighbors
 void average_neighbors(void* b_, const diy::Master::ProxyWithLink& cp, void*)
 {
@@ -67,14 +78,32 @@ int main(int argc, char* argv[])
   int                       threads   = 4;
   int                       in_memory = 8;
   std::string               prefix    = "./DIY.XXXXXX";
+  size_t                    budget    = 0;
+  size_t                    chunk     = 0;
+  size_t                    compress  = 0;
+  int                       prefetch  = 0;
+  std::string               evict     = "";
+  long                      tier      = -1;
 
   using namespace opts;
   Options ops(argc, argv);
+  bool                      opportunistic = ops >> Present('o', "opportunistic", "send queues as soon as each block is done");
+  bool                      split         = ops >> Present('s', "split",         "overlap the exchange with local work");
+  bool                      aggregate     = ops >> Present('a', "aggregate",     "send one message per rank");
+  bool                      sparse        = ops >> Present('n', "sparse",        "send only non-empty queues, terminate with a nonblocking barrier");
+  bool                      spill         = ops >> Present('l', "spill",         "keep the blocks moved out of core in one large file");
+  bool                      mapped        = ops >> Present(     "mmap",          "keep the blocks moved out of core in memory-mapped files");
   ops
       >> Option('b', "blocks",  nblocks,        "number of blocks")
       >> Option('t', "thread",  threads,        "number of threads")
       >> Option('m', "memory",  in_memory,      "maximum blocks to store in memory")
       >> Option(     "prefix",  prefix,         "prefix for external storage")
+      >> Option(     "budget",  budget,         "bytes allowed in flight (0 = no limit)")
+      >> Option(     "chunk",   chunk,          "send messages in pieces of this many bytes (0 = default)")
+      >> Option(     "compress", compress,      "compress queues and spilled data of at least this many bytes (0 = off)")
+      >> Option(     "prefetch", prefetch,      "blocks to load ahead in the background, when out of core")
+      >> Option(     "evict",   evict,          "evict blocks one at a time: lru, cost, or shared-lru")
+      >> Option(     "tier",    tier,           "keep the blocks moved out of core compressed in memory, up to this many bytes, before the disk (-1 = off)")
   ;
 
   if (ops >> Present('h', "help", "show help"))
@@ -86,14 +115,37 @@ int main(int argc, char* argv[])
   }
 
   diy::FileStorage          storage(prefix);
+  diy::SpillStorage         spill_storage(prefix);
+  diy::MmapStorage          mmap_storage(prefix);
+  diy::ExternalStorage*     disk = spill  ? (diy::ExternalStorage*) &spill_storage :
+                                   mapped ? (diy::ExternalStorage*) &mmap_storage  : &storage;
+  diy::CompressedStorage    compressed_storage(std::max(tier, 0L), disk);
   diy::Master               master(world,
                                    threads,
                                    in_memory,
                                    &create_block,
                                    &destroy_block,
-                                   &storage,
+                                   tier >= 0 ? &compressed_storage : disk,
                                    &save_block,
                                    &load_block);
+  master.set_aggregate(aggregate);
+  master.set_sparse(sparse);
+  master.set_inflight_budget(budget);
+  master.set_prefetch(prefetch);
+  if (evict == "lru")
+    master.set_eviction_policy(new diy::Master::LRUEviction);
+  else if (evict == "cost")
+    master.set_eviction_policy(new diy::Master::CostAwareEviction);
+  else if (evict == "shared-lru")
+    master.set_eviction_policy(new diy::Master::LRUEviction(true));
+  if (chunk)
+    master.set_chunk_size(chunk, 2);
+  diy::LZCodec              codec;
+  if (compress)
+  {
+    master.set_compression(&codec, compress);
+    storage.set_compression(&codec, compress);
+  }
 
   //diy::ContiguousAssigner   assigner(world.size(), nblocks);
   diy::RoundRobinAssigner   assigner(world.size(), nblocks);
@@ -129,8 +181,19 @@ int main(int argc, char* argv[])
     master.add(gid, b, link);
   }
 
-  master.foreach(&local_average);
-  master.exchange();
+  if (opportunistic)
+    master.foreach_exchange(&local_average);
+  else if (split)
+  {
+    master.foreach(&local_average);
+    master.exchange_begin();
+    master.foreach(&local_work);
+    master.exchange_end();
+  } else
+  {
+    master.foreach(&local_average);
+    master.exchange();
+  }
 
   master.foreach(&average_neighbors);
 
@@ -0,0 +1,281 @@
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include <diy/mpi.hpp>
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+#include <diy/storage.hpp>
+#include <diy/compression.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Checks that a split-phase exchange, with a foreach in between exchange_begin() and exchange_end(),
+// delivers the same queues as exchange(), also when blocks move in and out of core during that foreach;
+// and so does foreach_exchange(), which sends the queues early, if asked to. The options turn on the
+// other ways of sending the queues, so that the received queues are checked for those as well.
+// Every block sends its field to its two neighbors in a ring, between a header and a footer,
+// as a copy or as a reference (Proxy::enqueue_ref()). Finally, the fields are received as views
+// (Proxy::dequeue_view()), which are checked after the foreach, once the blocks have moved out of core.
+
+struct Block
+{
+  std::vector<float>    field;
+  int                   work;
+  int                   errors;
+
+                        Block(): work(0), errors(0)     {}
+};
+
+void* create_block()                        { return new Block; }
+void  destroy_block(void* b)                { delete static_cast<Block*>(b); }
+void  save_block(const void* b_, diy::BinaryBuffer& bb)
+{
+  const Block* b = static_cast<const Block*>(b_);
+  diy::save(bb, b->field); diy::save(bb, b->work); diy::save(bb, b->errors);
+}
+void  load_block(void* b_, diy::BinaryBuffer& bb)
+{
+  Block* b = static_cast<Block*>(b_);
+  diy::load(bb, b->field); diy::load(bb, b->work); diy::load(bb, b->errors);
+}
+
+typedef     std::map<int, std::vector<float> >      Sums;       // gid -> what the block received, in every round
+
+float value(int gid, int round, size_t i)   { return gid * 1000 + round * 10 + i % 7; }
+
+struct Send
+{
+        Send(bool reference_, int round_): reference(reference_), round(round_)    {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void*) const
+  {
+    Block*      b = static_cast<Block*>(b_);
+    diy::Link*  l = cp.link();
+    for (size_t i = 0; i < b->field.size(); ++i)
+      b->field[i] = value(cp.gid(), round, i);
+    for (int i = 0; i < l->size(); ++i)
+    {
+      cp.enqueue(l->target(i), cp.gid());
+      if (reference)
+        cp.enqueue_ref(l->target(i), &b->field[0], b->field.size());
+      else
+        cp.enqueue(l->target(i), &b->field[0], b->field.size());
+      cp.enqueue(l->target(i), -cp.gid());
+    }
+  }
+
+  bool  reference;
+  int   round;
+};
+
+// in between exchange_begin() and exchange_end(): leave the field (and the incoming queues) alone
+void  work(void* b_, const diy::Master::ProxyWithLink&, void*)
+{
+  static_cast<Block*>(b_)->work++;
+}
+
+struct Receive
+{
+        Receive(int round_): round(round_)          {}
+
+  void  operator()(void* b_, const diy::Master::ProxyWithLink& cp, void* sums_) const
+  {
+    Block*        b    = static_cast<Block*>(b_);
+    diy::Link*    l    = cp.link();
+    Sums&         sums = *static_cast<Sums*>(sums_);
+
+    std::vector<float> in(b->field.size());
+    float sum = 0;
+    for (int i = 0; i < l->size(); ++i)
+    {
+      int from = l->target(i).gid, header, footer;
+      cp.dequeue(from, header);
+      cp.dequeue(from, &in[0], in.size());
+      cp.dequeue(from, footer);
+      bool ok = header == from && footer == -from;
+      for (size_t j = 0; j < in.size() && ok; ++j)
+        ok = in[j] == value(from, round, j);
+      if (!ok)
+      {
+        fprintf(stderr, "Error: block %d got a wrong queue from %d in round %d\n", cp.gid(), from, round);
+        b->errors++;
+      }
+      sum += in.back();
+    }
+    sums[cp.gid()][round] = sum;
+  }
+
+  int   round;
+};
+
+typedef     std::map<int, std::map<int, diy::ArrayView<float> > >    Views;      // gid -> (from -> the field it received, in place)
+
+// keep the views past the foreach
+void  view(void* b_, const diy::Master::ProxyWithLink& cp, void* views_)
+{
+  Block*        b     = static_cast<Block*>(b_);
+  diy::Link*    l     = cp.link();
+  Views&        views = *static_cast<Views*>(views_);
+  for (int i = 0; i < l->size(); ++i)
+  {
+    int from = l->target(i).gid, header, footer;
+    cp.dequeue(from, header);
+    views[cp.gid()][from] = cp.dequeue_view<float>(from, b->field.size());
+    cp.dequeue(from, footer);
+  }
+}
+
+void  run(diy::Master& master, bool reference, bool split, bool early, int rounds, Sums& sums)
+{
+  for (unsigned i = 0; i < master.size(); ++i)
+    sums[master.gid(i)].assign(rounds, 0);      // filled in by the threads, without changing the map
+
+  for (int round = 0; round < rounds; ++round)
+  {
+    if (early)
+      master.foreach_exchange(Send(reference, round));
+    else if (split)
+    {
+      master.foreach(Send(reference, round));
+      master.exchange_begin();
+      master.foreach(&work);
+      master.exchange_end();
+    } else
+    {
+      master.foreach(Send(reference, round));
+      master.exchange();
+    }
+    master.foreach(Receive(round), &sums);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  diy::mpi::environment     env(argc, argv);
+  diy::mpi::communicator    world;
+
+  int                       nblocks    = 4*world.size();
+  int                       size       = 10000;          // large enough for the queues to go to storage (see QueueSizePolicy)
+  int                       rounds     = 3;
+  int                       in_memory  = 2;
+  int                       threads    = 1;
+  std::string               prefix     = "./DIY.XXXXXX";
+  size_t                    budget     = 0;
+  size_t                    chunk      = 0;
+  size_t                    compress   = 0;
+
+  using namespace opts;
+  Options ops(argc, argv);
+  bool                      aggregate  = ops >> Present('a', "aggregate", "send one message per rank");
+  bool                      early      = ops >> Present('o', "opportunistic", "also check foreach_exchange(), which sends queues as soon as each block is done");
+  bool                      sparse     = ops >> Present(     "sparse",    "send only non-empty queues, terminate with a nonblocking barrier");
+  bool                      prepost    = ops >> Present(     "prepost",   "post the receives for the next exchange in advance");
+  ops
+      >> Option('b', "blocks",      nblocks,    "number of blocks")
+      >> Option('n', "size",        size,       "number of floats in each block's field")
+      >> Option('i', "rounds",      rounds,     "number of exchanges")
+      >> Option('m', "memory",      in_memory,  "maximum blocks to store in memory")
+      >> Option('t', "threads",     threads,    "number of threads")
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+      >> Option(     "budget",      budget,     "bytes allowed in flight (0 = no limit)")
+      >> Option(     "chunk",       chunk,      "send messages in pieces of this many bytes (0 = default)")
+      >> Option(     "compress",    compress,   "compress queues of at least this many bytes (0 = off)")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    if (world.rank() == 0)
+        std::cout << ops;
+    return 1;
+  }
+
+  diy::FileStorage          storage(prefix);
+  diy::Master               master(world, threads, in_memory,
+                                   &create_block, &destroy_block,
+                                   &storage, &save_block, &load_block);
+  master.set_aggregate(aggregate);
+  master.set_sparse(sparse);
+  master.set_prepost(prepost);
+  master.set_inflight_budget(budget);
+  if (chunk)
+    master.set_chunk_size(chunk, 2);
+  diy::LZCodec              codec;
+  if (compress)
+    master.set_compression(&codec, compress);
+  diy::ContiguousAssigner   assigner(world.size(), nblocks);
+
+  std::vector<int> gids;
+  assigner.local_gids(world.rank(), gids);
+  for (unsigned i = 0; i < gids.size(); ++i)
+  {
+    diy::Link*  link = new diy::Link;
+    for (int j = -1; j <= 1; j += 2)
+    {
+      diy::BlockID  nbr;
+      nbr.gid  = (gids[i] + j + nblocks) % nblocks;
+      nbr.proc = assigner.rank(nbr.gid);
+      link->add_neighbor(nbr);
+    }
+
+    Block* b = new Block;
+    b->field.resize(size);
+    master.add(gids[i], b, link);
+  }
+
+  int mismatches = 0;
+  for (int reference = 0; reference < 2; ++reference)
+  {
+    Sums    expected, split, opportunistic;
+    run(master, reference, false, false, rounds, expected);
+    run(master, reference, true,  false, rounds, split);
+    if (split != expected)
+    {
+      fprintf(stderr, "Error: the split-phase exchange differs from exchange() on rank %d (%s)\n",
+                      world.rank(), reference ? "references" : "copies");
+      ++mismatches;
+    }
+    if (!early)
+      continue;
+    run(master, reference, false, true,  rounds, opportunistic);
+    if (opportunistic != expected)
+    {
+      fprintf(stderr, "Error: foreach_exchange() differs from exchange() on rank %d (%s)\n",
+                      world.rank(), reference ? "references" : "copies");
+      ++mismatches;
+    }
+  }
+
+  Views views;
+  for (unsigned i = 0; i < master.size(); ++i)
+    views[master.gid(i)];                       // filled in by the threads, without changing the map
+  master.foreach(Send(false, rounds));
+  master.exchange();
+  master.foreach(&view, &views);
+  for (Views::const_iterator it = views.begin(); it != views.end(); ++it)
+    for (std::map<int, diy::ArrayView<float> >::const_iterator cur = it->second.begin(); cur != it->second.end(); ++cur)
+    {
+      bool ok = cur->second.size() == (size_t) size;
+      for (size_t j = 0; j < cur->second.size() && ok; ++j)
+        ok = cur->second[j] == value(cur->first, rounds, j);
+      if (!ok)
+      {
+        fprintf(stderr, "Error: block %d's view of the queue from %d changed after the foreach\n", it->first, cur->first);
+        ++mismatches;
+      }
+    }
+
+  for (unsigned i = 0; i < master.size(); ++i)
+  {
+    Block* b = static_cast<Block*>(master.get(i));
+    mismatches += b->errors;
+  }
+
+  int total;
+  diy::mpi::all_reduce(world, mismatches, total, std::plus<int>());
+  if (world.rank() == 0)
+    fprintf(stdout, "%s: %d blocks, %d floats each, %d in memory, %d ranks\n",
+                    total ? "FAILED" : "OK", nblocks, size, in_memory, world.size());
+  return total ? 1 : 0;
+}
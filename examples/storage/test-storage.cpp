@@ -0,0 +1,226 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+
+#include <diy/storage.hpp>
+#include <diy/spill-storage.hpp>
+#include <diy/mmap-storage.hpp>
+#include <diy/compressed-storage.hpp>
+#include <diy/serialization.hpp>
+
+#include "../opts.h"
+
+// Checks that the storage backends give back exactly what was put into them: records of mixed sizes,
+// put as queues (MemoryBuffer) and as blocks (save and load functions), read back or destroyed in between,
+// so that their space gets reused, and (for SpillStorage) with the files compacted before the last reads.
+// CompressedStorage gets a budget too small for all the records, so that some overflow.
+
+typedef     std::vector<char>       Block;
+
+void  save_block(const void* b, diy::BinaryBuffer& bb)  { diy::save(bb, *static_cast<const Block*>(b)); }
+void  load_block(void* b,       diy::BinaryBuffer& bb)  { diy::load(bb, *static_cast<Block*>(b)); }
+
+// odd seeds give data that doesn't compress, even seeds data that does
+Block       contents(size_t size, int seed)
+{
+  Block         x(size);
+  unsigned      r = seed;
+  for (size_t j = 0; j < size; ++j)
+  {
+    r = r * 1103515245 + 12345;
+    x[j] = (seed % 2) ? char(r >> 16) : char(seed + j % 7);
+  }
+  return x;
+}
+
+struct Record
+{
+  size_t    size;
+  int       seed;
+  bool      block;      // put and got with save and load functions
+};
+
+int         put(diy::ExternalStorage& storage, const Record& r)
+{
+  Block x = contents(r.size, r.seed);
+  if (r.block)
+    return storage.put(&x, &save_block);
+
+  diy::MemoryBuffer bb;
+  diy::save(bb, x);
+  return storage.put(bb);
+}
+
+bool        get(diy::ExternalStorage& storage, int id, const Record& r)
+{
+  Block x;
+  if (r.block)
+    storage.get(id, &x, &load_block);
+  else
+  {
+    diy::MemoryBuffer bb;
+    storage.get(id, bb, 0);
+    diy::load(bb, x);
+  }
+  return x == contents(r.size, r.seed);
+}
+
+void        compact(diy::ExternalStorage&)          {}
+void        compact(diy::SpillStorage& storage)     { storage.compact(); }
+
+// destroys or reads back all the records but every `keep`-th (in the order of their ids)
+template<class Storage>
+bool        thin(Storage& storage, std::map<int, Record>& records, int keep)
+{
+  bool ok = true;
+  int  k  = 0;
+  for (std::map<int, Record>::iterator it = records.begin(); it != records.end(); ++k)
+  {
+    if (k % keep == 0)
+    {
+      ++it;
+      continue;
+    }
+    if (k % 2)
+      storage.destroy(it->first);
+    else
+      ok &= get(storage, it->first, it->second);
+    records.erase(it++);
+  }
+  return ok;
+}
+
+// puts records, keeps a third of them, puts as many again (into the space just freed), keeps every other one
+// (so that there are holes in front of the records left), optionally compacts, and reads everything back
+template<class Storage>
+bool        churn(Storage& storage, bool compact_files)
+{
+  static const size_t   sizes[] = { 0, 1, 100, 4095, 5000, (1 << 16) + 3, 200000 };
+  static const int      nsizes  = sizeof(sizes) / sizeof(sizes[0]);
+
+  std::map<int, Record> records;
+  bool                  ok   = true;
+  int                   seed = 0;
+  for (int round = 0; round < 2; ++round)
+  {
+    for (int k = 0; k < 24; ++k)
+    {
+      Record r;
+      r.size  = sizes[(k + round) % nsizes];
+      r.seed  = ++seed;
+      r.block = k % 2;
+      records[put(storage, r)] = r;
+    }
+    ok &= thin(storage, records, 3 - round);
+  }
+
+  if (compact_files)
+    compact(storage);
+
+  for (std::map<int, Record>::iterator it = records.begin(); it != records.end(); ++it)
+    ok &= get(storage, it->first, it->second);
+  return ok;
+}
+
+// Puts records of the given sizes into the storage, in order, and checks that they all come back intact.
+bool        round_trip(diy::ExternalStorage& storage, const std::vector<size_t>& sizes)
+{
+  std::vector<int>      ids;
+  for (size_t i = 0; i < sizes.size(); ++i)
+  {
+    diy::MemoryBuffer bb;
+    bb.buffer.resize(sizes[i]);
+    for (size_t j = 0; j < sizes[i]; ++j)
+      bb.buffer[j] = char(i + j);
+    ids.push_back(storage.put(bb));
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < sizes.size(); ++i)
+  {
+    diy::MemoryBuffer bb;
+    storage.get(ids[i], bb, 0);
+    if (bb.size() != sizes[i])
+      ok = false;
+    for (size_t j = 0; ok && j < sizes[i]; ++j)
+      if (bb.buffer[j] != char(i + j))
+        ok = false;
+  }
+  return ok;
+}
+
+bool        report(const std::string& what, bool ok)
+{
+  std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+int main(int argc, char* argv[])
+{
+  std::string               prefix     = "./DIY.XXXXXX";
+
+  using namespace opts;
+  Options ops(argc, argv);
+  ops
+      >> Option(     "prefix",      prefix,     "prefix for external storage")
+  ;
+
+  if (ops >> Present('h', "help", "show help"))
+  {
+    std::cout << ops;
+    return 1;
+  }
+
+  bool ok = true;
+
+  {
+    diy::SpillStorage       storage(prefix);
+    ok &= report("SpillStorage", churn(storage, false));
+  }
+  {
+    diy::SpillStorage       storage(prefix);
+    ok &= report("SpillStorage, compacted", churn(storage, true));
+  }
+  {
+    diy::SpillStorage       storage(prefix, true);
+    ok &= report("SpillStorage, direct, compacted", churn(storage, true));
+  }
+  {
+    std::vector<std::string>    prefixes(2, prefix);
+    diy::SpillStorage           storage(prefixes);
+    ok &= report("SpillStorage, two files, compacted", churn(storage, true));
+  }
+
+  {
+    diy::SpillStorage       next(prefix);
+    diy::CompressedStorage  storage(1 << 16, &next);
+    ok &= report("CompressedStorage, overflowing to SpillStorage",
+                 churn(storage, false) && storage.hits() > 0 && storage.misses() > 0 && next.count() > 0);
+  }
+  {
+    diy::CompressedStorage  storage(1 << 16);
+    ok &= report("CompressedStorage, over its budget",
+                 churn(storage, false) && storage.overflows() > 0 && storage.max_size() > storage.budget());
+  }
+
+  {
+    diy::MmapStorage        storage(prefix, 1 << 16);
+    ok &= report("MmapStorage", churn(storage, false));
+  }
+  {
+    // a record larger than a segment gets a segment of its own, which must leave the file end
+    // on a page boundary, so that the segments mapped after it can still be mapped
+    size_t                  segment = 4096;
+    std::vector<size_t>     sizes;
+    sizes.push_back(segment + 904);
+    sizes.push_back(100);
+    sizes.push_back(3 * segment + 1);
+    sizes.push_back(segment);
+
+    diy::MmapStorage        storage(prefix, segment);
+    ok &= report("MmapStorage, records larger than a segment", round_trip(storage, sizes));
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+#ifndef DIY_COMPRESSED_STORAGE_HPP
+#define DIY_COMPRESSED_STORAGE_HPP
+
+#include <vector>
+#include <map>
+
+#include "storage.hpp"
+#include "compression.hpp"
+#include "serialization.hpp"
+#include "critical-resource.hpp"
+
+namespace diy
+{
+  //! External storage that keeps records in memory, compressed with a codec (LZCodec by default), as long as
+  //! they fit within a budget of `budget` compressed bytes. Records that don't fit overflow to the `next`
+  //! storage (e.g., a FileStorage or a SpillStorage), which gets them uncompressed (it may compress them itself);
+  //! without `next`, they are kept in memory anyway, and only counted. Records that compress poorly are kept
+  //! as they are. The storage doesn't own the codec or the next storage.
+  class CompressedStorage: public ExternalStorage
+  {
+    public:
+                    CompressedStorage(size_t budget, ExternalStorage* next = 0, const Codec* codec = 0):
+                      budget_(budget), next_(next), codec_(codec ? codec : &default_codec_)     {}
+
+      virtual inline int    put(MemoryBuffer& bb);
+      virtual inline int    put(const void* x, detail::Save save);
+      virtual inline void   get(int i, MemoryBuffer& bb, size_t extra = 0);
+      virtual inline void   get(int i, void* x, detail::Load load);
+      virtual inline void   destroy(int i);
+
+      size_t        budget() const              { return budget_; }
+      ExternalStorage*  next() const            { return next_; }
+
+      int           count() const               { return state_.const_access()->count; }
+      size_t        current_size() const        { return state_.const_access()->current_size; }    //!< compressed bytes in memory
+      size_t        max_size() const            { return state_.const_access()->max_size; }
+      size_t        original_size() const       { return state_.const_access()->original_size; }   //!< bytes in memory, before compression
+
+      size_t        hits() const                { return state_.const_access()->hits; }            //!< records read back from memory
+      size_t        misses() const              { return state_.const_access()->misses; }          //!< records read back from the next storage
+      size_t        overflows() const           { return state_.const_access()->overflows; }       //!< records that didn't fit within the budget
+
+    private:
+      struct Record
+      {
+                        Record(): original(0), next(-1)         {}
+
+        std::vector<char>   data;
+        size_t              original;   // size before compression, or 0 if the data is not compressed
+        int                 next;       // id in the next storage, or -1 if the record is in memory
+      };
+
+      struct State
+      {
+                        State(): count(0), current_size(0), max_size(0), original_size(0),
+                                 hits(0), misses(0), overflows(0)                           {}
+
+        std::map<int, Record>   records;
+        int                     count;
+        size_t                  current_size, max_size, original_size;
+        size_t                  hits, misses, overflows;
+      };
+      typedef       critical_resource<State>        CriticalState;
+
+      inline bool   full() const;                       // no point compressing: the record goes to the next storage
+      inline int    overflow(int j);                    // record j in the next storage
+      inline Record extract(int i, bool count = true);
+      inline void   decompress(Record& r, MemoryBuffer& bb, size_t extra) const;
+
+                    // codec_ may point at default_codec_; not copyable
+                    CompressedStorage(const CompressedStorage&);
+      CompressedStorage&    operator=(const CompressedStorage&);
+
+    private:
+      size_t                        budget_;
+      ExternalStorage*              next_;
+      LZCodec                       default_codec_;
+      const Codec*                  codec_;
+      CriticalState                 state_;
+  };
+}
+
+int
+diy::CompressedStorage::
+put(MemoryBuffer& bb)
+{
+  if (full())
+    return overflow(next_->put(bb));
+
+  Record r;
+  if (!bb.empty())
+  {
+    codec_->compress(&bb.buffer[0], bb.size(), r.data);
+    if (r.data.size() < bb.size())
+    {
+      r.original = bb.size();
+      std::vector<char>(r.data).swap(r.data);       // give back the room the codec reserved
+    }
+  }
+  size_t size = r.original ? r.data.size() : bb.size();
+
+  {
+    CriticalState::accessor state = state_.access();
+    bool fits = state->current_size + size <= budget_;
+    if (!fits)
+      ++state->overflows;
+    if (fits || !next_)
+    {
+      if (!r.original)
+        r.data.swap(bb.buffer);
+      bb.wipe();
+
+      int i = state->count++;
+      state->current_size   += r.data.size();
+      state->original_size  += r.original ? r.original : r.data.size();
+      if (state->current_size > state->max_size)
+        state->max_size = state->current_size;
+      state->records[i].data.swap(r.data);
+      state->records[i].original = r.original;
+      return i;
+    }
+  }
+
+  // the next storage gets the record uncompressed
+  int j = next_->put(bb);
+  CriticalState::accessor state = state_.access();
+  int i = state->count++;
+  state->records[i].next = j;
+  return i;
+}
+
+int
+diy::CompressedStorage::
+put(const void* x, detail::Save save)
+{
+  if (full())
+    return overflow(next_->put(x, save));
+
+  MemoryBuffer bb;
+  save(x, bb);
+  return put(bb);
+}
+
+void
+diy::CompressedStorage::
+get(int i, MemoryBuffer& bb, size_t extra)
+{
+  Record r = extract(i);
+  if (r.next >= 0)
+    next_->get(r.next, bb, extra);
+  else
+    decompress(r, bb, extra);
+}
+
+void
+diy::CompressedStorage::
+get(int i, void* x, detail::Load load)
+{
+  Record r = extract(i);
+  if (r.next >= 0)
+    next_->get(r.next, x, load);
+  else
+  {
+    MemoryBuffer bb;
+    decompress(r, bb, 0);
+    load(x, bb);
+  }
+}
+
+void
+diy::CompressedStorage::
+destroy(int i)
+{
+  Record r = extract(i, false);
+  if (r.next >= 0)
+    next_->destroy(r.next);
+}
+
+bool
+diy::CompressedStorage::
+full() const
+{
+  return next_ && state_.const_access()->current_size >= budget_;
+}
+
+int
+diy::CompressedStorage::
+overflow(int j)
+{
+  CriticalState::accessor state = state_.access();
+  ++state->overflows;
+  int i = state->count++;
+  state->records[i].next = j;
+  return i;
+}
+
+diy::CompressedStorage::Record
+diy::CompressedStorage::
+extract(int i, bool count)
+{
+  CriticalState::accessor state = state_.access();
+  std::map<int, Record>::iterator it = state->records.find(i);
+  Record r;
+  r.data.swap(it->second.data);
+  r.original = it->second.original;
+  r.next     = it->second.next;
+  state->records.erase(it);
+
+  if (r.next < 0)
+  {
+    state->current_size  -= r.data.size();
+    state->original_size -= r.original ? r.original : r.data.size();
+  }
+  if (count)
+    ++(r.next < 0 ? state->hits : state->misses);
+  return r;
+}
+
+void
+diy::CompressedStorage::
+decompress(Record& r, MemoryBuffer& bb, size_t extra) const
+{
+  bb.clear();
+  if (!r.original)
+  {
+    r.data.swap(bb.buffer);
+    bb.buffer.reserve(bb.buffer.size() + extra);
+    return;
+  }
+  bb.buffer.reserve(r.original + extra);
+  bb.buffer.resize(r.original);
+  codec_->decompress(&r.data[0], r.data.size(), &bb.buffer[0], r.original);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef DIY_COMPRESSION_HPP
+#define DIY_COMPRESSION_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "serialization.hpp"
+
+namespace diy
+{
+  //! Lossless compressor for queues sent between ranks (Master::set_compression())
+  //! and for records written to external storage (FileStorage::set_compression()).
+  //! The same codec may be used by several threads at once.
+  class Codec
+  {
+    public:
+      virtual       ~Codec()                                                                        {}
+
+      //! compresses `size` bytes at `in`, appending the result to `out`
+      virtual void  compress(const char* in, size_t size, std::vector<char>& out) const             =0;
+      //! decompresses `size` bytes at `in` into `out`, which the caller sizes to the original size, `out_size`
+      virtual void  decompress(const char* in, size_t size, char* out, size_t out_size) const       =0;
+  };
+
+  //! A fast LZ77 codec (in the spirit of LZ4): runs of literals alternate with back-references of
+  //! at least 4 bytes into the last 64 KiB. With `element_size` > 1, the bytes are first regrouped by
+  //! their position within each element (as in Blosc's shuffle), so that, e.g., the exponents of
+  //! a float field end up next to each other, which makes smooth numerical data far more compressible.
+  class LZCodec: public Codec
+  {
+    public:
+                    LZCodec(size_t element_size = 1):
+                      element_size_(element_size < 1 ? 1 : element_size)                            {}
+
+      inline void   compress(const char* in, size_t size, std::vector<char>& out) const;
+      inline void   decompress(const char* in, size_t size, char* out, size_t out_size) const;
+
+      size_t        element_size() const                                                            { return element_size_; }
+
+    private:
+      typedef       unsigned char                   byte;
+
+      static inline void    compress_block(const byte* in, size_t size, std::vector<char>& out);
+      static inline void    decompress_block(const byte* in, size_t size, byte* out, size_t out_size);
+
+      inline void   shuffle(const byte* in, size_t size, byte* out) const;
+      inline void   unshuffle(const byte* in, size_t size, byte* out) const;
+
+      static unsigned       read32(const byte* p)       { unsigned x; std::memcpy(&x, p, 4); return x; }
+      static unsigned       hash(unsigned x)            { return (x * 2654435761u) >> (32 - hash_bits); }
+
+      static const int      hash_bits   = 14;
+      static const size_t   min_match   = 4;
+      static const size_t   max_offset  = 65535;
+
+      size_t        element_size_;
+  };
+
+  namespace detail
+  {
+    // Compresses bb in place, if it's at least `threshold` bytes and the codec makes it smaller,
+    // and appends a footer that records whether it did, so that the receiver knows what to do
+    // (see decode()): the original size, if compressed, followed by a flag byte.
+    inline void     encode(const Codec& codec, size_t threshold, MemoryBuffer& bb);
+
+    // undoes encode(): strips the footer and decompresses bb, if necessary
+    inline void     decode(const Codec& codec, MemoryBuffer& bb);
+  }
+}
+
+void
+diy::LZCodec::
+compress(const char* in, size_t size, std::vector<char>& out) const
+{
+  if (element_size_ == 1)
+  {
+    compress_block((const byte*) in, size, out);
+    return;
+  }
+
+  std::vector<byte> shuffled(size);
+  shuffle((const byte*) in, size, size ? &shuffled[0] : 0);
+  compress_block(size ? &shuffled[0] : 0, size, out);
+}
+
+void
+diy::LZCodec::
+decompress(const char* in, size_t size, char* out, size_t out_size) const
+{
+  if (element_size_ == 1)
+  {
+    decompress_block((const byte*) in, size, (byte*) out, out_size);
+    return;
+  }
+
+  std::vector<byte> shuffled(out_size);
+  decompress_block((const byte*) in, size, out_size ? &shuffled[0] : 0, out_size);
+  unshuffle(out_size ? &shuffled[0] : 0, out_size, (byte*) out);
+}
+
+void
+diy::LZCodec::
+compress_block(const byte* in, size_t size, std::vector<char>& out)
+{
+  // sequences: token (literal length : 4 | match length - 4 : 4), extra literal length bytes,
+  //            literals, offset (2 bytes, little endian), extra match length bytes;
+  //            the last sequence has only literals
+  out.reserve(out.size() + size + size/255 + 16);
+
+  std::vector<size_t>   table(1 << hash_bits, 0);
+  size_t                anchor = 0,
+                        i      = 0,
+                        misses = 0;
+  while (size >= min_match && i <= size - min_match)
+  {
+    unsigned seq       = read32(in + i);
+    size_t&  entry     = table[hash(seq)];
+    size_t   candidate = entry;
+    entry = i;
+
+    if (candidate >= i || i - candidate > max_offset || read32(in + candidate) != seq)
+    {
+      i += 1 + (misses++ >> 6);        // skip faster through data that doesn't compress
+      continue;
+    }
+    misses = 0;
+
+    size_t length = min_match;
+    while (i + length < size && in[candidate + length] == in[i + length])
+      ++length;
+
+    size_t literals = i - anchor;
+    size_t extra    = length - min_match;
+    out.push_back((char) ((std::min(literals, (size_t) 15) << 4) | std::min(extra, (size_t) 15)));
+    if (literals >= 15)
+    {
+      size_t l = literals - 15;
+      for (; l >= 255; l -= 255)
+        out.push_back((char) 255);
+      out.push_back((char) l);
+    }
+    out.insert(out.end(), in + anchor, in + i);
+    size_t offset = i - candidate;
+    out.push_back((char) (offset & 0xff));
+    out.push_back((char) (offset >> 8));
+    if (extra >= 15)
+    {
+      size_t l = extra - 15;
+      for (; l >= 255; l -= 255)
+        out.push_back((char) 255);
+      out.push_back((char) l);
+    }
+
+    i     += length;
+    anchor = i;
+    if (i - 2 + min_match <= size)
+      table[hash(read32(in + i - 2))] = i - 2;     // so that the next match can start inside this one
+  }
+
+  // last literals
+  size_t literals = size - anchor;
+  out.push_back((char) (std::min(literals, (size_t) 15) << 4));
+  if (literals >= 15)
+  {
+    size_t l = literals - 15;
+    for (; l >= 255; l -= 255)
+      out.push_back((char) 255);
+    out.push_back((char) l);
+  }
+  out.insert(out.end(), in + anchor, in + size);
+}
+
+void
+diy::LZCodec::
+decompress_block(const byte* in, size_t size, byte* out, size_t out_size)
+{
+  const byte*   ip  = in;
+  const byte*   end = in + size;
+  size_t        op  = 0;
+  while (ip < end)
+  {
+    byte token = *ip++;
+
+    size_t literals = token >> 4;
+    if (literals == 15)
+    {
+      byte b;
+      do
+      {
+        if (ip == end)
+          throw std::runtime_error("diy::LZCodec: corrupted data");
+        b = *ip++;
+        literals += b;
+      } while (b == 255);
+    }
+    if (literals > (size_t) (end - ip) || literals > out_size - op)
+      throw std::runtime_error("diy::LZCodec: corrupted data");
+    std::memcpy(out + op, ip, literals);
+    ip += literals;
+    op += literals;
+
+    if (ip == end)
+      break;                // the last sequence has no match
+
+    if (end - ip < 2)
+      throw std::runtime_error("diy::LZCodec: corrupted data");
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+
+    size_t length = (token & 15) + min_match;
+    if ((token & 15) == 15)
+    {
+      byte b;
+      do
+      {
+        if (ip == end)
+          throw std::runtime_error("diy::LZCodec: corrupted data");
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    if (offset == 0 || offset > op || length > out_size - op)
+      throw std::runtime_error("diy::LZCodec: corrupted data");
+
+    const byte* match = out + op - offset;
+    if (offset >= length)
+      std::memcpy(out + op, match, length);
+    else
+      for (size_t k = 0; k < length; ++k)       // overlapping: a repeated pattern
+        out[op + k] = match[k];
+    op += length;
+  }
+
+  if (op != out_size)
+    throw std::runtime_error("diy::LZCodec: corrupted data");
+}
+
+void
+diy::LZCodec::
+shuffle(const byte* in, size_t size, byte* out) const
+{
+  size_t count = size / element_size_;
+  for (size_t j = 0; j < element_size_; ++j)
+    for (size_t i = 0; i < count; ++i)
+      out[j*count + i] = in[i*element_size_ + j];
+  std::memcpy(out + count*element_size_, in + count*element_size_, size - count*element_size_);   // leftover bytes
+}
+
+void
+diy::LZCodec::
+unshuffle(const byte* in, size_t size, byte* out) const
+{
+  size_t count = size / element_size_;
+  for (size_t j = 0; j < element_size_; ++j)
+    for (size_t i = 0; i < count; ++i)
+      out[i*element_size_ + j] = in[j*count + i];
+  std::memcpy(out + count*element_size_, in + count*element_size_, size - count*element_size_);
+}
+
+void
+diy::detail::
+encode(const Codec& codec, size_t threshold, MemoryBuffer& bb)
+{
+  char compressed = 0;
+  if (bb.size() >= threshold && !bb.empty())
+  {
+    std::vector<char> out;
+    codec.compress(&bb.buffer[0], bb.size(), out);
+    if (out.size() + sizeof(size_t) < bb.size())
+    {
+      size_t size = bb.size();
+      bb.buffer.swap(out);
+      bb.position = bb.size();
+      diy::save(bb, size);
+      compressed = 1;
+    }
+  }
+  bb.position = bb.size();
+  diy::save(bb, compressed);
+}
+
+void
+diy::detail::
+decode(const Codec& codec, MemoryBuffer& bb)
+{
+  char compressed;
+  diy::load_back(bb, compressed);
+  if (!compressed)
+    return;
+
+  size_t size;
+  diy::load_back(bb, size);
+  std::vector<char> out(size);
+  codec.decompress(bb.empty() ? 0 : &bb.buffer[0], bb.size(), size ? &out[0] : 0, size);
+  bb.buffer.swap(out);
+  bb.position = 0;
+}
+
+#endif
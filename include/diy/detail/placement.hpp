@@ -0,0 +1,183 @@
+#ifndef DIY_PLACEMENT_HPP
+#define DIY_PLACEMENT_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sys/time.h>
+#include <sys/statvfs.h>
+
+#include "../thread.hpp"
+
+namespace diy
+{
+namespace detail
+{
+  // Chooses where to put each record, among the directories of the filename templates of a storage.
+  // A record goes to the directory with the highest throughput per operation in flight (so the fastest
+  // directory gets the records while it keeps up, and the others take the overflow, when there is more
+  // than one operation at a time), among those with room for it. Throughput is measured from the timed
+  // reads and writes the storage reports; directories that haven't been measured, or haven't been used
+  // in a while, are tried first. Free space is checked at most once a second, and estimated in between.
+  class Placement
+  {
+    public:
+      inline        Placement(const std::vector<std::string>& filename_templates);
+
+      //! choose the target for a record of `size` bytes, and start writing it
+      inline int    choose(size_t size);
+      //! start reading from the target
+      inline void   start(int target);
+      //! finish a read or a write of `bytes` bytes, which took `seconds`, if measured (> 0)
+      inline void   finish(int target, size_t bytes, double seconds = 0);
+      //! a write failed for lack of space
+      inline void   full(int target);
+
+      size_t        size() const                            { return targets_.size(); }
+
+      static double now()                                   { timeval t; gettimeofday(&t, 0); return t.tv_sec + t.tv_usec * 1e-6; }
+
+    private:
+      struct Target
+      {
+                        Target(): free(0), headroom(0), checked(-1), inflight(0), bytes(0), seconds(0), used(0)    {}
+
+        std::string     directory;
+        size_t          free;           // estimate of the bytes available
+        size_t          headroom;       // bytes to leave free on the device
+        double          checked;        // when the free space was last checked (< 0: never)
+        int             inflight;       // reads and writes in progress
+        double          bytes, seconds; // decayed sums of the timed transfers
+        size_t          used;           // the choice that last picked the target
+      };
+
+      inline void   check(Target& t, double time) const;
+      inline double throughput(const Target& t) const;
+
+      static const size_t   stale   = 256;      // choices after which an unused target's throughput is measured again
+      static double         decay()                 { return .9; }
+
+    private:
+      std::vector<Target>   targets_;
+      size_t                choices_;
+      fast_mutex            m_;
+  };
+}
+}
+
+diy::detail::Placement::
+Placement(const std::vector<std::string>& filename_templates):
+  targets_(filename_templates.size()), choices_(0)
+{
+  for (size_t i = 0; i < targets_.size(); ++i)
+  {
+    const std::string& name = filename_templates[i];
+    size_t slash = name.rfind('/');
+    targets_[i].directory = slash == std::string::npos ? "." : slash == 0 ? "/" : name.substr(0, slash);
+  }
+}
+
+int
+diy::detail::Placement::
+choose(size_t size)
+{
+  lock_guard<fast_mutex>    lock(m_);
+  ++choices_;
+  if (targets_.size() == 1)
+  {
+    ++targets_[0].inflight;
+    return 0;
+  }
+
+  double    time = now();
+  int       best = -1, roomiest = 0;
+  double    best_score = 0;
+  for (size_t i = 0; i < targets_.size(); ++i)
+  {
+    Target& t = targets_[i];
+    check(t, time);
+    if (t.free > targets_[roomiest].free)
+      roomiest = i;
+    if (t.free < size + t.headroom)
+      continue;
+
+    // unmeasured targets come first, then the least busy
+    double score = throughput(t);
+    score = (score == 0 ? 1e300 : score) / (t.inflight + 1);
+    if (best < 0 || score > best_score ||
+        (score == best_score && t.inflight < targets_[best].inflight))
+    {
+      best       = i;
+      best_score = score;
+    }
+  }
+  if (best < 0)
+    best = roomiest;        // no room anywhere: the emptiest target has the best chance
+
+  Target& t = targets_[best];
+  t.free  = t.free > size ? t.free - size : 0;
+  t.used  = choices_;
+  ++t.inflight;
+  return best;
+}
+
+void
+diy::detail::Placement::
+start(int target)
+{
+  lock_guard<fast_mutex>    lock(m_);
+  ++targets_[target].inflight;
+}
+
+void
+diy::detail::Placement::
+finish(int target, size_t bytes, double seconds)
+{
+  lock_guard<fast_mutex>    lock(m_);
+  Target& t = targets_[target];
+  --t.inflight;
+  if (seconds > 0)
+  {
+    t.bytes   = decay() * t.bytes   + bytes;
+    t.seconds = decay() * t.seconds + seconds;
+  }
+}
+
+void
+diy::detail::Placement::
+full(int target)
+{
+  lock_guard<fast_mutex>    lock(m_);
+  targets_[target].checked = -1;
+  check(targets_[target], now());
+}
+
+void
+diy::detail::Placement::
+check(Target& t, double time) const
+{
+  if (t.checked >= 0 && time - t.checked < 1)
+    return;
+  t.checked = time;
+
+  struct statvfs fs;
+  if (statvfs(t.directory.c_str(), &fs) != 0)
+  {
+    t.free = t.headroom = 0;
+    return;
+  }
+  t.free     = size_t(fs.f_bavail) * fs.f_frsize;
+  t.headroom = std::min(size_t(fs.f_blocks) * fs.f_frsize / 50, size_t(1) << 30);     // 2% of the device, up to 1 GiB
+}
+
+double
+diy::detail::Placement::
+throughput(const Target& t) const
+{
+  if (t.seconds == 0 || choices_ - t.used > stale)
+    return 0;
+  return t.bytes / t.seconds;
+}
+
+#endif
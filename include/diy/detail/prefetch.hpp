@@ -0,0 +1,209 @@
+#ifndef DIY_PREFETCH_HPP
+#define DIY_PREFETCH_HPP
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "../thread.hpp"
+
+namespace diy
+{
+namespace detail
+{
+  // Loads items (blocks) on a background thread, ahead of the workers that process them.
+  // Workers request the items they are about to get to; before processing an item,
+  // a worker claims it, which waits for its load to finish, or takes the load over,
+  // if it hasn't started yet. Every item is loaded at most once between start() and finish().
+  // Without threads, requests are ignored.
+  class Prefetcher
+  {
+    public:
+      typedef       bool (*Load)(void* arg, int item);     // loads the item, unless there is no room for it (returns false)
+
+                    Prefetcher():
+                      load_(0), arg_(0), loaded_(0), stop_(false), thread_(0)   {}
+      inline        ~Prefetcher();
+
+      //! start accepting requests for items in `[0, items)`
+      inline void   start(Load load, void* arg, int items);
+      //! drop the outstanding requests and wait for the load in progress, if any
+      inline void   finish();
+
+      inline void   request(int item);
+      inline void   claim(int item);
+
+      //! number of items loaded, but not claimed yet
+      inline int    ready();
+
+    private:
+      enum          State { none, queued, loading, loaded, claimed };
+
+      inline static void work(void* p);
+
+                    Prefetcher(const Prefetcher&);
+      Prefetcher&   operator=(const Prefetcher&);
+
+    private:
+      Load                  load_;
+      void*                 arg_;
+      std::vector<char>     states_;
+      std::deque<int>       requests_;
+      int                   loaded_;
+      bool                  stop_;
+
+#ifndef DIY_NO_THREADS
+      thread*               thread_;
+      mutex                 m_;
+      condition_variable    requested_;
+      condition_variable    done_;
+#else
+      void*                 thread_;
+#endif
+  };
+}
+}
+
+diy::detail::Prefetcher::
+~Prefetcher()
+{
+#ifndef DIY_NO_THREADS
+  if (!thread_)
+    return;
+
+  {
+    lock_guard<mutex>   lock(m_);
+    stop_ = true;
+    requested_.notify_all();
+  }
+  thread_->join();
+  delete thread_;
+#endif
+}
+
+void
+diy::detail::Prefetcher::
+start(Load load, void* arg, int items)
+{
+#ifndef DIY_NO_THREADS
+  if (!thread_)
+    thread_ = new thread(&Prefetcher::work, this);
+
+  lock_guard<mutex>   lock(m_);
+  load_   = load;
+  arg_    = arg;
+  states_.assign(items, none);
+  requests_.clear();
+  loaded_ = 0;
+#else
+  (void) load;
+  (void) arg;
+  (void) items;
+#endif
+}
+
+void
+diy::detail::Prefetcher::
+finish()
+{
+#ifndef DIY_NO_THREADS
+  if (!thread_)
+    return;
+
+  lock_guard<mutex>   lock(m_);
+  for (std::deque<int>::const_iterator it = requests_.begin(); it != requests_.end(); ++it)
+    states_[*it] = none;
+  requests_.clear();
+  while (std::find(states_.begin(), states_.end(), (char) loading) != states_.end())
+    done_.wait(m_);
+  load_ = 0;
+#endif
+}
+
+void
+diy::detail::Prefetcher::
+request(int item)
+{
+#ifndef DIY_NO_THREADS
+  lock_guard<mutex>   lock(m_);
+  if (!load_ || states_[item] != none)
+    return;
+  states_[item] = queued;
+  requests_.push_back(item);
+  requested_.notify_one();
+#else
+  (void) item;
+#endif
+}
+
+void
+diy::detail::Prefetcher::
+claim(int item)
+{
+#ifndef DIY_NO_THREADS
+  lock_guard<mutex>   lock(m_);
+  if (!load_)
+    return;
+  if (states_[item] == queued)
+    requests_.erase(std::find(requests_.begin(), requests_.end(), item));
+  while (states_[item] == loading)
+    done_.wait(m_);
+  if (states_[item] == loaded)
+    --loaded_;
+  states_[item] = claimed;
+#else
+  (void) item;
+#endif
+}
+
+int
+diy::detail::Prefetcher::
+ready()
+{
+#ifndef DIY_NO_THREADS
+  lock_guard<mutex>   lock(m_);
+  return loaded_;
+#else
+  return 0;
+#endif
+}
+
+void
+diy::detail::Prefetcher::
+work(void* p)
+{
+#ifndef DIY_NO_THREADS
+  Prefetcher&   pf = *static_cast<Prefetcher*>(p);
+  while (true)
+  {
+    int     item;
+    Load    load;
+    void*   arg;
+    {
+      lock_guard<mutex>   lock(pf.m_);
+      while (pf.requests_.empty() && !pf.stop_)
+        pf.requested_.wait(pf.m_);
+      if (pf.stop_)
+        return;
+
+      item = pf.requests_.front();
+      pf.requests_.pop_front();
+      pf.states_[item] = loading;
+      load = pf.load_;
+      arg  = pf.arg_;
+    }
+
+    bool success = load(arg, item);
+
+    lock_guard<mutex>   lock(pf.m_);
+    pf.states_[item] = success ? loaded : none;      // if there was no room, the worker loads the item itself
+    if (success)
+      ++pf.loaded_;
+    pf.done_.notify_all();
+  }
+#else
+  (void) p;
+#endif
+}
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef DIY_THREAD_POOL_HPP
+#define DIY_THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "../thread.hpp"
+
+namespace diy
+{
+namespace detail
+{
+  // Per-worker deques of work items (local block ids).
+  // A worker takes items from the front of its own deque; once that runs dry,
+  // it steals from the back of the other deques.
+  class WorkQueues
+  {
+    public:
+      typedef       std::deque<int>                 Items;
+
+                    WorkQueues(int workers):
+                      workers_(workers),
+                      queues_(new Queue[workers])       {}
+                    ~WorkQueues()                       { delete[] queues_; }
+
+      int           workers() const                     { return workers_; }
+
+      // deal the items round-robin, so that every worker sees them in the original order
+      inline void   fill(const Items& items);
+      inline bool   pop(int worker, int& item);
+      // the (up to) `n` items the worker will take next from its own deque
+      inline void   peek(int worker, size_t n, std::vector<int>& items);
+
+    private:
+      struct Queue
+      {
+        Items       items;
+        fast_mutex  m;
+      };
+
+      inline bool   take_front(int worker, int& item);
+      inline bool   take_back(int victim, int& item);
+
+                    WorkQueues(const WorkQueues&);
+      WorkQueues&   operator=(const WorkQueues&);
+
+    private:
+      int           workers_;
+      Queue*        queues_;
+  };
+
+  // Persistent pool of worker threads.
+  // The threads are launched on first use and wait for jobs until the pool is destroyed.
+  // The calling thread participates in every job as worker 0.
+  class ThreadPool
+  {
+    public:
+      typedef       void (*Job)(void* arg, int worker);
+
+                    ThreadPool():
+                      job_(0), arg_(0), workers_(0),
+                      generation_(0), done_(0), stop_(false)    {}
+      inline        ~ThreadPool();
+
+      //! run `job(arg, w)` for every `w` in `[0, workers)` and wait for all of them to finish
+      inline void   run(Job job, void* arg, int workers);
+
+      //! number of workers available without launching new threads
+      int           size() const                        { return helpers_.size() + 1; }
+
+    private:
+      struct Helper
+      {
+        ThreadPool* pool;
+        int         id;
+        unsigned    generation;     // last job seen
+        thread*     t;
+      };
+
+      inline void   grow(int workers);
+      inline void   wait(int workers);          // for the helpers to finish the current job
+      inline static void work(void* h);
+
+                    ThreadPool(const ThreadPool&);
+      ThreadPool&   operator=(const ThreadPool&);
+
+    private:
+      std::vector<Helper*>  helpers_;
+
+      Job                   job_;
+      void*                 arg_;
+      int                   workers_;
+      unsigned              generation_;
+      int                   done_;
+      bool                  stop_;
+
+#ifndef DIY_NO_THREADS
+      mutex                 m_;
+      condition_variable    start_;
+      condition_variable    finished_;
+#endif
+  };
+}
+}
+
+void
+diy::detail::WorkQueues::
+fill(const Items& items)
+{
+  for (unsigned i = 0; i < items.size(); ++i)
+    queues_[i % workers_].items.push_back(items[i]);
+}
+
+bool
+diy::detail::WorkQueues::
+pop(int worker, int& item)
+{
+  if (take_front(worker, item))
+    return true;
+
+  for (int i = 1; i < workers_; ++i)
+    if (take_back((worker + i) % workers_, item))
+      return true;
+
+  return false;
+}
+
+void
+diy::detail::WorkQueues::
+peek(int worker, size_t n, std::vector<int>& items)
+{
+  Queue& q = queues_[worker];
+  lock_guard<fast_mutex>    lock(q.m);
+  n = std::min(n, q.items.size());
+  items.assign(q.items.begin(), q.items.begin() + n);
+}
+
+bool
+diy::detail::WorkQueues::
+take_front(int worker, int& item)
+{
+  Queue& q = queues_[worker];
+  lock_guard<fast_mutex>    lock(q.m);
+  if (q.items.empty())
+    return false;
+  item = q.items.front();
+  q.items.pop_front();
+  return true;
+}
+
+bool
+diy::detail::WorkQueues::
+take_back(int victim, int& item)
+{
+  Queue& q = queues_[victim];
+  lock_guard<fast_mutex>    lock(q.m);
+  if (q.items.empty())
+    return false;
+  item = q.items.back();
+  q.items.pop_back();
+  return true;
+}
+
+diy::detail::ThreadPool::
+~ThreadPool()
+{
+#ifndef DIY_NO_THREADS
+  {
+    lock_guard<mutex>   lock(m_);
+    stop_ = true;
+    start_.notify_all();
+  }
+
+  for (unsigned i = 0; i < helpers_.size(); ++i)
+  {
+    helpers_[i]->t->join();
+    delete helpers_[i]->t;
+    delete helpers_[i];
+  }
+#endif
+}
+
+void
+diy::detail::ThreadPool::
+run(Job job, void* arg, int workers)
+{
+#ifdef DIY_NO_THREADS
+  // worker 0 goes last, as it would finish last if the helpers were running alongside it
+  for (int w = workers - 1; w >= 0; --w)
+    job(arg, w);
+#else
+  if (workers > 1)
+  {
+    grow(workers);
+
+    lock_guard<mutex>   lock(m_);
+    job_      = job;
+    arg_      = arg;
+    workers_  = workers;
+    done_     = 0;
+    ++generation_;
+    start_.notify_all();
+  }
+
+  // the helpers use arg, which may live on the caller's stack: wait for them, even if worker 0 throws
+  try
+  {
+    job(arg, 0);
+  } catch (...)
+  {
+    wait(workers);
+    throw;
+  }
+  wait(workers);
+#endif
+}
+
+void
+diy::detail::ThreadPool::
+wait(int workers)
+{
+#ifndef DIY_NO_THREADS
+  if (workers > 1)
+  {
+    lock_guard<mutex>   lock(m_);
+    while (done_ < workers_ - 1)
+      finished_.wait(m_);
+  }
+#else
+  (void) workers;
+#endif
+}
+
+void
+diy::detail::ThreadPool::
+grow(int workers)
+{
+#ifndef DIY_NO_THREADS
+  while (size() < workers)
+  {
+    Helper* h = new Helper;
+    h->pool = this;
+    h->id   = size();
+    h->generation = generation_;
+    helpers_.push_back(h);
+    h->t    = new thread(&ThreadPool::work, h);
+  }
+#else
+  (void) workers;
+#endif
+}
+
+void
+diy::detail::ThreadPool::
+work(void* h_)
+{
+#ifndef DIY_NO_THREADS
+  Helper*       h    = static_cast<Helper*>(h_);
+  ThreadPool&   pool = *h->pool;
+
+  unsigned&     seen = h->generation;
+  while (true)
+  {
+    Job   job;
+    void* arg;
+    {
+      lock_guard<mutex>   lock(pool.m_);
+      while (pool.generation_ == seen && !pool.stop_)
+        pool.start_.wait(pool.m_);
+      if (pool.stop_)
+        return;
+
+      seen = pool.generation_;
+      if (h->id >= pool.workers_)       // not needed for this job
+        continue;
+      job  = pool.job_;
+      arg  = pool.arg_;
+    }
+
+    job(arg, h->id);
+
+    lock_guard<mutex>   lock(pool.m_);
+    if (++pool.done_ == pool.workers_ - 1)
+      pool.finished_.notify_all();
+  }
+#else
+  (void) h_;
+#endif
+}
+
+#endif
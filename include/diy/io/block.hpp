@@ -40,7 +40,8 @@ namespace io
   write_blocks(const std::string&           outfilename,
                const mpi::communicator&     comm,
                Master&                      master,
-               typename Master::SaveBlock   save = 0)
+               typename Master::SaveBlock   save = 0,
+               bool                         varint_links = false)   // smaller links, unreadable by diy from before the varint encoding
   {
     if (!save) save = master.saver();       // save is likely to be different from master.save()
 
@@ -69,8 +70,11 @@ namespace io
       {
         // get the block from master and serialize it
         const void* block = master.get(i);
-        MemoryBuffer bb;
-        LinkFactory::save(bb, master.link(i));
+        CountingBuffer cb;                      // size it first, so that bb is allocated once
+        LinkFactory::save(cb, master.link(i), varint_links);
+        save(block, cb);
+        MemoryBuffer bb;    bb.reserve(cb.count);
+        LinkFactory::save(bb, master.link(i), varint_links);
         save(block, bb);
         count = bb.buffer.size();
         mpi::scan(comm, count, offset, std::plus<offset_t>());
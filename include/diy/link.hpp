@@ -7,6 +7,7 @@
 
 #include "types.hpp"
 #include "serialization.hpp"
+#include "varint.hpp"
 #include "assigner.hpp"
 
 namespace diy
@@ -29,12 +30,17 @@ namespace diy
 
       void      fix(const Assigner& assigner)       { for (unsigned i = 0; i < neighbors_.size(); ++i) { neighbors_[i].proc = assigner.rank(neighbors_[i].gid); } }
 
-      virtual void  save(BinaryBuffer& bb) const    { diy::save(bb, neighbors_); }
-      virtual void  load(BinaryBuffer& bb)          { diy::load(bb, neighbors_); }
+      virtual void  save(BinaryBuffer& bb) const    { save(bb, false); }
+      //! with `varint`, the neighbors are saved as varints of their gid differences: smaller, but versions
+      //! of diy from before this encoding can't read them; load() reads either layout
+      inline virtual void   save(BinaryBuffer& bb, bool varint) const;
+      inline virtual void   load(BinaryBuffer& bb);
 
       virtual size_t id() const                     { return 0; }
 
     private:
+      static const size_t   varint_layout = ~size_t(0);    // never a neighbor count
+
       std::vector<BlockID>  neighbors_;
   };
 
@@ -96,9 +102,10 @@ namespace diy
       void          add_bounds(const Bounds& bounds)    { nbr_bounds_.push_back(bounds); }
 
 
-      void      save(BinaryBuffer& bb) const
+      using     Link::save;
+      void      save(BinaryBuffer& bb, bool varint) const
       {
-          Link::save(bb);
+          Link::save(bb, varint);
           diy::save(bb, dim_);
           diy::save(bb, dir_map_);
           diy::save(bb, dir_vec_);
@@ -152,7 +159,8 @@ namespace diy
             return 0;
       }
 
-      inline static void    save(BinaryBuffer& bb, const Link* l);
+      //! `varint` chooses the layout of the neighbors (see Link::save())
+      inline static void    save(BinaryBuffer& bb, const Link* l, bool varint = false);
       inline static Link*   load(BinaryBuffer& bb);
   };
 }
@@ -160,10 +168,13 @@ namespace diy
 
 void
 diy::LinkFactory::
-save(BinaryBuffer& bb, const Link* l)
+save(BinaryBuffer& bb, const Link* l, bool varint)
 {
     diy::save(bb, l->id());
-    l->save(bb);
+    if (varint)
+        l->save(bb, true);
+    else
+        l->save(bb);            // links that override only this save() keep working
 }
 
 diy::Link*
@@ -177,6 +188,58 @@ load(BinaryBuffer& bb)
     return l;
 }
 
+void
+diy::Link::
+save(BinaryBuffer& bb, bool varint) const
+{
+  if (!varint)
+  {
+    diy::save(bb, neighbors_);      // original layout: the count, followed by the neighbors as they are in memory
+    return;
+  }
+
+  // neighbor gids tend to be close to each other, so they are saved as varints of their differences;
+  // the marker takes the place of the neighbor count of the original layout
+  size_t marker = varint_layout;
+  diy::save(bb, marker);
+
+  detail::VarintWriter  out(bb);
+  out.put(neighbors_.size());
+  long long prev = 0;
+  for (unsigned i = 0; i < neighbors_.size(); ++i)
+  {
+    out.put(detail::zigzag(neighbors_[i].gid - prev));
+    out.put(detail::zigzag(neighbors_[i].proc));
+    prev = neighbors_[i].gid;
+  }
+}
+
+void
+diy::Link::
+load(BinaryBuffer& bb)
+{
+  size_t marker;
+  diy::load(bb, marker);
+  if (marker != varint_layout)
+  {
+    // original layout: the count, followed by the neighbors as they are in memory
+    neighbors_.resize(marker);
+    if (!neighbors_.empty())
+      diy::load(bb, &neighbors_[0], neighbors_.size());
+    return;
+  }
+
+  detail::VarintReader  in(bb);
+  neighbors_.resize(in.get_size());
+  long long prev = 0;
+  for (unsigned i = 0; i < neighbors_.size(); ++i)
+  {
+    neighbors_[i].gid  = int(prev + detail::unzigzag<long long>(in.get()));
+    neighbors_[i].proc = detail::unzigzag<int>(in.get());
+    prev = neighbors_[i].gid;
+  }
+}
+
 int
 diy::Link::
 find(int gid) const
@@ -4,8 +4,10 @@
 #include <vector>
 #include <map>
 #include <list>
+#include <set>
 #include <deque>
 #include <algorithm>
+#include <climits>
 
 #include "link.hpp"
 #include "collection.hpp"
@@ -13,7 +15,12 @@
 // Communicator functionality
 #include "mpi.hpp"
 #include "serialization.hpp"
+#include "compression.hpp"
+#include "quantization.hpp"
 #include "detail/collectives.hpp"
+#include "detail/thread-pool.hpp"
+#include "detail/prefetch.hpp"
+#include "detail/placement.hpp"
 #include "time.hpp"
 
 #include "thread.hpp"
@@ -63,18 +70,87 @@ namespace diy
         size_t  size;
       };
 
+      //! Chooses the block to move out of core when a foreach needs room for another one (see set_eviction_policy())
+      struct EvictionPolicy
+      {
+                        EvictionPolicy(bool shared_ = false): shared(shared_)   {}
+        virtual         ~EvictionPolicy()                                       {}
+
+        //! block `i` was loaded from external storage in `time` seconds
+        virtual void    loaded(int /*i*/, double /*time*/)                      {}
+        //! block `i` was processed in memory
+        virtual void    used(int i)                                             =0;
+        //! choose the block to unload among the candidates (local ids of blocks in memory)
+        virtual int     victim(const std::vector<int>& candidates)              =0;
+
+        bool            shared;         //!< the workers of a foreach draw on the whole limit together, instead of an equal share each
+      };
+
+      //! Evicts the least recently used block
+      struct LRUEviction: public EvictionPolicy
+      {
+                        LRUEviction(bool shared = false):
+                          EvictionPolicy(shared), clock(0)                      {}
+
+        void            used(int i)                                             { if (i >= (int) last.size()) last.resize(i + 1, 0); last[i] = ++clock; }
+        inline int      victim(const std::vector<int>& candidates);
+
+        std::vector<size_t>     last;   // time of the last use of every block
+        size_t                  clock;
+      };
+
+      //! Evicts the block that is cheapest to load back, without keeping expensive blocks forever (GreedyDual):
+      //! using a block sets its priority to the baseline plus the time it took to load it last,
+      //! and every eviction raises the baseline to the priority of the evicted block
+      struct CostAwareEviction: public EvictionPolicy
+      {
+                        CostAwareEviction(bool shared = false):
+                          EvictionPolicy(shared), baseline(0)                   {}
+
+        void            loaded(int i, double time)                              { grow(i); cost[i] = time; }
+        void            used(int i)                                             { grow(i); priority[i] = baseline + cost[i]; }
+        inline int      victim(const std::vector<int>& candidates);
+
+        void            grow(int i)                                             { if (i >= (int) cost.size()) { cost.resize(i + 1, 0); priority.resize(i + 1, 0); } }
+
+        std::vector<double>     cost, priority;
+        double                  baseline;
+      };
+
+      struct Chunked;
       struct InFlight
       {
+                            InFlight(): chunked(0)  {}
+
         MemoryBuffer        message;
-        mpi::request        request;
+        Chunked*            chunked;                // the large message this is a piece of (message is then empty)
 
         // for debug purposes:
         int from, to;
+
+        void                swap(InFlight& o)       { message.swap(o.message); std::swap(chunked, o.chunked); std::swap(from, o.from); std::swap(to, o.to); }
+      };
+      struct Chunked                                // large message sent in pieces, after a header
+      {
+        MemoryBuffer        message;
+        int                 proc;
+        size_t              sent;                   // bytes handed to MPI
+        int                 pending;                // pieces in flight
+      };
+      struct Reassembly                             // large message received in pieces
+      {
+        int                 tag;                    // what kind of message it is (tags::queue or tags::packed_queues)
+        MemoryBuffer        message;
+        std::vector<mpi::request>   requests;
+        size_t              remaining;
       };
       struct Collective;
-      struct tags       { enum { queue }; };
+      struct tags       { enum { queue, packed_queues, preposted_queue, chunked_header, chunk, count }; };
 
-      typedef           std::list<InFlight>                 InFlightList;
+      typedef           std::deque<InFlight>                InFlightList;       // requests are kept separately, see inflight_requests_
+      typedef           std::vector<mpi::request>           Requests;
+      typedef           std::list<Chunked>                  ChunkedList;        // in the order of the headers
+      typedef           std::list<Reassembly>               ReassemblyList;
       typedef           std::list<int>                      ToSendList;         // [gid]
       typedef           std::list<Collective>               CollectivesList;
       typedef           std::map<int, CollectivesList>      CollectivesMap;     // gid          -> [collectives]
@@ -91,20 +167,55 @@ namespace diy
       typedef           std::map<int,     MemoryBuffer>     IncomingQueues;     //  gid         -> queue
       typedef           std::map<BlockID, MemoryBuffer>     OutgoingQueues;     // (gid, proc)  -> queue
       typedef           std::map<BlockID, QueueRecord>      OutQueueRecords;    // (gid, proc)  -> (size, external)
+      typedef           std::list< std::vector<char> >      RetiredBuffers;
       struct IncomingQueuesRecords
       {
+                        IncomingQueuesRecords(): viewed(false)      {}
+
         InQueueRecords  records;
         IncomingQueues  queues;
+        RetiredBuffers  retired;        // replaced queue buffers that views from Proxy::dequeue_view() may still point into
+        bool            viewed;         // views point into the queues: keep them in memory until the next foreach
+      };
+      struct Reference                              // caller-owned bytes spliced into an outgoing queue (see Proxy::enqueue_ref())
+      {
+        size_t          offset;         // position in the queue's own buffer where they go
+        const char*     data;
+        size_t          size;
       };
+      typedef           std::vector<Reference>              References;
+      typedef           std::map<BlockID, References>       OutgoingReferences; // (gid, proc)  -> [reference]
       struct OutgoingQueuesRecord
       {
-                        OutgoingQueuesRecord(int e = -1): external(e)       {}
+                        OutgoingQueuesRecord(int e = -1): external(e), size(0)  {}
         int             external;
+        size_t          size;           // of the remote queues in external storage
         OutQueueRecords external_local;
         OutgoingQueues  queues;
+        OutgoingReferences  references;
       };
       typedef           std::map<int,     IncomingQueuesRecords>    IncomingQueuesMap;  //  gid         -> {  gid       -> queue }
       typedef           std::map<int,     OutgoingQueuesRecord>     OutgoingQueuesMap;  //  gid         -> { (gid,proc) -> queue }
+      typedef           std::list< std::pair<int, OutgoingQueuesRecord> >   ReadyList;  // [(gid, queues)] done during foreach
+      typedef           std::map<int,     MemoryBuffer>     PackedQueues;       //  proc        -> queues bound for it
+
+      struct Traffic
+      {
+                        Traffic(): messages(0), largest(0)  {}
+        int             messages;
+        size_t          largest;
+      };
+      typedef           std::map<int,     Traffic>          TrafficMap;         //  proc        -> queue messages exchanged with it
+      struct Preposted
+      {
+        int             source;
+        size_t          size;           // posted
+        MemoryBuffer    message;
+
+        void            swap(Preposted& o)          { std::swap(source, o.source); std::swap(size, o.size); message.swap(o.message); }
+      };
+      typedef           std::deque<Preposted>               PrepostedList;
+      typedef           std::list< std::vector<char> >      BufferPool;
 
 
     public:
@@ -128,11 +239,31 @@ namespace diy
                       storage_(storage),
                       // Communicator functionality
                       comm_(comm),
+                      exchange_comm_(comm_.duplicate()),
+                      inflight_bytes_(0),
+                      inflight_budget_(0),
+                      chunk_size_(64*1024*1024),
+                      chunks_in_flight_(4),
                       inflight_size_(0),
                       expected_(0),
-                      received_(0)
+                      received_(0),
+                      send_early_(false),
+                      busy_(0),
+                      exchanging_(false),
+                      out_queues_limit_(0),
+                      aggregate_(false),
+                      packed_bytes_(0),
+                      sparse_(false),
+                      epoch_(0),
+                      prepost_(false),
+                      preposted_bytes_(0),
+                      codec_(0),
+                      codec_threshold_(0),
+                      prefetch_(0),
+                      eviction_(0),
+                      loading_(0)
                                                         {}
-                    ~Master()                           { clear(); delete queue_policy_; }
+                    ~Master()                           { cancel_requests(); clear(); exchange_comm_.free(); delete queue_policy_; delete eviction_; }
       inline void   clear();
       inline void   destroy(int i)                      { if (blocks_.own()) blocks_.destroy(i); }
 
@@ -157,9 +288,10 @@ namespace diy
       inline void   unload_outgoing(int gid);
       inline void   load_queues(int i);
       inline void   load_incoming(int gid);
-      inline void   load_outgoing(int gid);
+      inline void   load_outgoing(int gid)              { load_outgoing(outgoing_[gid]); }
 
-      //! return the MPI communicator
+      //! return the MPI communicator; the exchanges run on a duplicate of it (made when the master is
+      //! constructed, by all the processes together), so the user's messages on it never mix with the queues
       const mpi::communicator&  communicator() const    { return comm_; }
       //! return the MPI communicator
       mpi::communicator&        communicator()          { return comm_; }
@@ -174,9 +306,62 @@ namespace diy
       bool          local(int gid) const                { return lids_.find(gid) != lids_.end(); }
 
       //! exchange the queues between all the blocks (collective operation)
-      inline void   exchange();
+      void          exchange()                          { start_exchange(true); exchange_end(); }
+      //! start the exchange: the queues enqueued so far are sent out, while the blocks keep computing;
+      //! a foreach before exchange_end() must not read incoming queues (they may be incomplete),
+      //! what it enqueues goes out with the next exchange
+      void          exchange_begin()                    { start_exchange(limit_ == -1); }
+      //! complete the exchange started by exchange_begin() (collective operation)
+      inline void   exchange_end();
+      bool          exchanging() const                  { return exchanging_; }
       inline void   process_collectives();
 
+      //! pack all the queues bound for the same rank into a single message
+      void          set_aggregate(bool a)               { aggregate_ = a; }
+      bool          aggregate() const                   { return aggregate_; }
+
+      //! in sparse mode, only non-empty queues are sent and the exchange terminates with a nonblocking
+      //! barrier instead of counting the expected queues; blocks find out who sent them data with
+      //! Proxy::incoming(); reduce() turns the mode off
+      void          set_sparse(bool s)                  { sparse_ = s; }
+      bool          sparse() const                      { return sparse_; }
+
+      //! with prepost on, every rank posts receives for the next exchange, one for each queue message it got
+      //! from a rank in the current one and as large as the largest of them; the senders, who know the same
+      //! numbers, send the queues that fit straight into those receives; must be set the same way on all ranks
+      void          set_prepost(bool p)                 { prepost_ = p; }
+      bool          prepost() const                     { return prepost_; }
+
+      //! bound on the bytes in flight: queues being sent (or packed to be sent) and preposted receives;
+      //! a block's queues are not sent until they fit, unless nothing else is in flight; 0 means no bound
+      void          set_inflight_budget(size_t b)       { inflight_budget_ = b; }
+      size_t        inflight_budget() const             { return inflight_budget_; }
+      size_t        inflight_bytes() const              { return inflight_bytes_ + packed_bytes_ + preposted_bytes_; }
+
+      //! messages larger than `chunk_size` bytes are sent in pieces of that size, with up to
+      //! `chunks_in_flight` pieces of each message in flight at a time (which also lifts MPI's 2 GiB count limit)
+      void          set_chunk_size(size_t chunk_size, int chunks_in_flight = 4)
+      { chunk_size_ = std::max((size_t) 1, std::min(chunk_size, (size_t) INT_MAX)); chunks_in_flight_ = std::max(1, chunks_in_flight); }
+      size_t        chunk_size() const                  { return chunk_size_; }
+
+      //! compress the queues sent to other ranks that are at least `threshold` bytes with `codec`
+      //! (0 turns compression off); smaller queues, and those that don't shrink, are sent as they are;
+      //! the queues are then sent as copies, even if enqueued by reference; must be set the same way on all ranks
+      void          set_compression(const Codec* codec, size_t threshold = 4096)    { codec_ = codec; codec_threshold_ = threshold; }
+      const Codec*  compression() const                 { return codec_; }
+
+      //! when blocks are stored out of core, each foreach worker has the next `blocks` blocks of its share
+      //! loaded on a background thread, while it processes the current one; the prefetched blocks
+      //! count toward the limit, so each worker keeps that many fewer processed blocks in memory
+      void          set_prefetch(int blocks)            { prefetch_ = std::max(0, blocks); }
+      int           prefetch() const                    { return prefetch_; }
+
+      //! when blocks are stored out of core, evict them one at a time, as chosen by `policy`, whenever a worker
+      //! (or add()) needs room for another block, instead of unloading all the blocks the worker has processed,
+      //! so that the blocks used in consecutive foreach calls stay in memory; the master takes ownership of the policy
+      void          set_eviction_policy(EvictionPolicy* policy)     { delete eviction_; eviction_ = policy; }
+      EvictionPolicy*   eviction_policy() const                     { return eviction_; }
+
       inline
       ProxyWithLink proxy(int i) const;
 
@@ -213,10 +398,25 @@ namespace diy
       template<class Block, class Functor, class Skip>
       void          foreach(const Functor& f, const Skip& skip, void* aux = 0);
 
+      //! foreach() followed by exchange() (collective operation), with the queues of every block sent (and
+      //! the queues addressed to local blocks received) as soon as the block is done, leaving less work
+      //! for the exchange
+      template<class Functor>
+      void          foreach_exchange(const Functor& f)                  { foreach_exchange(f, NeverSkip()); }
+
+      template<class Functor, class T>
+      void          foreach_exchange(const Functor& f, T* aux)          { foreach_exchange(f, NeverSkip(), aux); }
+
+      template<class Functor, class Skip>
+      void          foreach_exchange(const Functor& f, const Skip& skip, void* aux = 0)
+      { send_early_ = true; foreach<void>(f, skip, aux); exchange(); }
+
     public:
       // Communicator functionality
       IncomingQueues&   incoming(int gid)               { return incoming_[gid].queues; }
+      IncomingQueuesRecords&    incoming_records(int gid)   { return incoming_[gid]; }
       OutgoingQueues&   outgoing(int gid)               { return outgoing_[gid].queues; }
+      OutgoingReferences&   outgoing_references(int gid)    { return outgoing_[gid].references; }
       CollectivesList&  collectives(int gid)            { return collectives_[gid]; }
       size_t            incoming_count(int gid) const   { IncomingQueuesMap::const_iterator it = incoming_.find(gid); if (it == incoming_.end()) return 0; return it->second.queues.size(); }
       size_t            outgoing_count(int gid) const   { OutgoingQueuesMap::const_iterator it = outgoing_.find(gid); if (it == outgoing_.end()) return 0; return it->second.queues.size(); }
@@ -227,14 +427,69 @@ namespace diy
 
     public:
       // Communicator functionality
-      inline void       flush();            // makes sure all the serialized queues migrate to their target processors
+      void              flush()             { flush_begin(); flush_end(); }     // makes sure all the serialized queues migrate to their target processors
+      inline void       flush_begin(bool gather = true);    // starts sending the serialized queues (and the references, in place, if gather)
+      inline void       flush_end();        // waits until all the queues have migrated
 
     private:
       // Communicator functionality
-      inline void       comm_exchange(ToSendList& to_send, int out_queues_limit);     // possibly called in between block computations
+      inline void       comm_exchange(ToSendList& to_send, size_t out_queues_limit,               // possibly called in between block computations
+                                      OutgoingQueuesMap& outgoing, IncomingQueuesMap& incoming);
+      inline void       start_exchange(bool gather);    // gather the references in place only if their blocks can't be unloaded before the exchange ends
+      inline void       load_outgoing(OutgoingQueuesRecord& out_qr);
+
+      // the remote queues of a block, as they are moved to and from external storage
+      struct RemoteQueues
+      {
+        const OutgoingQueues*   queues;
+        int                     rank;
+      };
+      inline static void    save_remote_queues(const void* remote, BinaryBuffer& bb);
+      inline static void    load_remote_queues(void* queues, BinaryBuffer& bb);
+      inline void       send_outgoing_queues(int from, OutgoingQueuesRecord& out, IncomingQueuesMap& incoming);
+      inline void       receive_queues(IncomingQueuesMap& incoming);
+      inline void       receive_queue(int from, int to, MemoryBuffer& bb, IncomingQueuesMap& incoming);
+      inline void       send_packed_queues();
+      inline mpi::request   send_queue(int proc, int tag, MemoryBuffer& bb);
+      inline void       post_send(int proc, int tag, MemoryBuffer& bb, int from, int to, References* refs = 0);
+      inline static size_t  references_size(const References* refs);
+      inline static void    materialize(MemoryBuffer& bb, References& refs);         // copy the referenced data into the queue
+      inline static void    materialize(OutgoingQueuesRecord& out);
+      inline void       send_chunks();
+      inline void       receive_chunked(IncomingQueuesMap& incoming);
+      inline void       finish_reassembly(IncomingQueuesMap& incoming);
+      inline void       receive_message(int tag, MemoryBuffer& bb, IncomingQueuesMap& incoming);
+      inline void       post_receives();
+      inline void       finish_preposted(IncomingQueuesMap& incoming);
+      inline void       reuse_buffer(MemoryBuffer& bb);
+      inline size_t     outgoing_size(const OutgoingQueuesRecord& out) const;
+      inline bool       within_budget(const OutgoingQueuesRecord& out) const;
+      inline void       recycle_buffer(MemoryBuffer& bb);
+      int               tag(int t) const    { return t + tags::count*(epoch_ % 2); }    // keeps consecutive exchanges apart
       inline bool       nudge();
 
-      void              cancel_requests();              // TODO
+      // drop the entries whose requests completed (listed in increasing order), keeping the rest contiguous
+      template<class Entries>
+      static void       remove_completed(Entries& entries, Requests& requests, const std::vector<int>& completed);
+
+      // Opportunistic communication
+      inline void       ready(int i);                   // block i is done; queue up its outgoing queues
+      inline void       touch_outgoing(int i);          // make sure block i has an outgoing queue for each neighbor
+      inline void       comm_ready(size_t out_queues_limit);    // send ready queues and receive early ones; called only from the main thread
+      inline void       comm_progress(size_t out_queues_limit);    // advance whatever communication is in progress during foreach
+      inline void       merge_early_incoming();
+      inline void       clear_incoming();               // also destroys the queues moved out to storage
+      inline void       keep_viewed(IncomingQueuesRecords& in);     // set aside the buffers views point into, until the next foreach
+
+      // Prefetching
+      inline static bool    prefetch_load(void* master, int i);     // called by prefetcher_
+
+      // Eviction
+      inline int        evict(const std::vector<int>& candidates);  // ask eviction_ for a victim
+      inline void       used(int i, bool processed);                // block i is done; with a shared budget, it may be evicted
+      inline void       load_within_limit(int i, int reserve);      // load block i, evicting processed blocks to stay within the (shared) limit
+
+      inline void       cancel_requests();              // cancel the receives preposted for an exchange that never comes
 
       // debug
       inline void       show_incoming_records() const;
@@ -251,17 +506,78 @@ namespace diy
       int                   threads_;
       ExternalStorage*      storage_;
 
+      detail::ThreadPool    pool_;              // persistent worker threads, reused by every foreach
+
     private:
       // Communicator
       mpi::communicator     comm_;
+      mpi::communicator     exchange_comm_;         // duplicate of comm_ that carries the exchanges, so that they can't match the user's messages
       IncomingQueuesMap     incoming_;
       OutgoingQueuesMap     outgoing_;
       InFlightList          inflight_;
+      Requests              inflight_requests_;     // contiguous, completed in batches with test_some()
+      size_t                inflight_bytes_;
+      size_t                inflight_budget_;
+      ChunkedList           chunked_;
+      ReassemblyList        reassembling_;
+      size_t                chunk_size_;
+      int                   chunks_in_flight_;
       size_t                inflight_size_;
       CollectivesMap        collectives_;
       int                   expected_;
       int                   received_;
 
+      // Opportunistic communication
+      bool                      send_early_;        // the next foreach is the one of foreach_exchange()
+      critical_resource<ReadyList>  ready_;         // outgoing queues of the blocks done in the current foreach
+      critical_resource<int>    busy_;              // workers still processing blocks
+      std::set<int>             flushed_;           // gids whose queues were already sent during foreach
+      IncomingQueuesMap         early_incoming_;    // queues received while blocks are being processed (for the next round)
+
+      // Split-phase exchange
+      bool                      exchanging_;        // between exchange_begin() and exchange_end()
+      OutgoingQueuesMap         sending_;           // queues of the exchange in progress
+      ToSendList                to_send_;
+      size_t                    out_queues_limit_;
+
+      // Aggregation
+      bool                      aggregate_;
+      PackedQueues              packed_;            // remote queues waiting to be sent, one message per rank
+      size_t                    packed_bytes_;
+
+      // Sparse exchange
+      bool                      sparse_;
+      unsigned                  epoch_;             // number of completed exchanges
+
+      // Receives
+      BufferPool                spare_buffers_;     // storage of the completed sends, reused by the receives
+      bool                      prepost_;
+      TrafficMap                sent_;              // queue messages of the current exchange, by destination
+      TrafficMap                received_from_;     // queue messages of the current exchange, by source
+      TrafficMap                credits_;           // receives preposted for us by each rank
+      PrepostedList             preposted_;         // receives we preposted
+      Requests                  preposted_requests_;
+      size_t                    preposted_bytes_;
+      std::vector<int>          completed_;         // scratch space for test_some()
+      std::vector<mpi::status>  statuses_;
+
+      // Compression
+      const Codec*              codec_;
+      size_t                    codec_threshold_;
+
+      // Prefetching
+      int                       prefetch_;
+      detail::Prefetcher        prefetcher_;
+
+      // Eviction
+      EvictionPolicy*           eviction_;
+      fast_mutex                eviction_mutex_;    // guards eviction_, evictable_, loading_
+      std::vector<int>          evictable_;         // blocks processed in the current foreach, with a shared budget
+      int                       loading_;           // blocks being loaded within the limit
+
+      // Zero-copy dequeue
+      critical_resource<RetiredBuffers> viewed_;    // cleared queue buffers that views from the last foreach point into
+
     private:
       fast_mutex            add_mutex_;
   };
@@ -273,46 +589,64 @@ namespace diy
                          const Skip&                skip_,
                          void*                      aux_,
                          Master&                    master_,
-                         const std::deque<int>&     blocks_,
                          int                        local_limit_,
-                         critical_resource<int>&    idx_):
+                         detail::WorkQueues&        queues_,
+                         size_t                     out_queues_limit_ = 0,
+                         int                        prefetch_ = 0,
+                         bool                       early = false):
                 f(f_), skip(skip_), aux(aux_),
                 master(master_),
-                blocks(blocks_),
                 local_limit(local_limit_),
-                idx(idx_)
+                queues(queues_),
+                out_queues_limit(out_queues_limit_),
+                prefetch(prefetch_),
+                shared(master.eviction_ && master.eviction_->shared),
+                reserve(prefetch_ * queues_.workers()),
+                hand_off(early),
+                communicate(early || master.exchanging_)
             {}
 
-    void    process()
+    void    process(int worker)
     {
       //fprintf(stdout, "Processing with thread: %d\n",  (int) this_thread::get_id());
 
       std::vector<int>      local;
-      do
+      std::vector<int>      next;
+      int i;
+      while (queues.pop(worker, i))
       {
-        int cur = (*idx.access())++;
-
-        if (cur >= blocks.size())
-            return;
+        if (worker == 0 && communicate)
+            master.comm_progress(out_queues_limit);
 
-        int i = blocks[cur];
-        if (master.block(i))
+        if (prefetch)
         {
-          if (local.size() == local_limit)
-            master.unload(local);
-          local.push_back(i);
+          // have the blocks after this one loaded in the background, then wait for this one, if it's being loaded
+          queues.peek(worker, prefetch, next);
+          for (unsigned j = 0; j < next.size(); ++j)
+            if (!skip(next[j], master))
+              master.prefetcher_.request(next[j]);
+          master.prefetcher_.claim(i);
         }
 
-        if (skip(i, master))
+        if (master.block(i) && !shared)
+          keep(i, local);
+
+        bool skipped = skip(i, master);
+        if (skipped)
         {
             if (master.block(i) == 0)
                 master.load_queues(i);      // even though we are skipping the block, the queues might be necessary
 
             f(0, master.proxy(i), aux);     // 0 signals that we are skipping the block (even if it's loaded)
+            if (hand_off)
+                master.ready(i);
 
             // no longer need them, so get rid of them, rather than risk reloading
-            master.incoming_[master.gid(i)].queues.clear();
-            master.incoming_[master.gid(i)].records.clear();
+            IncomingQueuesRecords& in = master.incoming_[master.gid(i)];
+            master.keep_viewed(in);
+            in.queues.clear();
+            in.records.clear();
+            in.retired.clear();
 
             if (master.block(i) == 0)
                 master.unload_queues(i);    // even though we are skipping the block, the queues might be necessary
@@ -321,30 +655,71 @@ namespace diy
         {
             if (master.block(i) == 0)                             // block unloaded
             {
-              if (local.size() == local_limit)                    // reached the local limit
-                master.unload(local);
-
-              master.load(i);
-              local.push_back(i);
+              if (shared)
+                master.load_within_limit(i, reserve);
+              else
+              {
+                keep(i, local);
+                master.load(i);
+              }
             }
 
             f(master.block<Block>(i), master.proxy(i), aux);
+            if (hand_off)
+                master.ready(i);
+        }
+
+        if (master.eviction_ && master.block(i))
+          master.used(i, !skipped);
+      }
+
+      if (!communicate)
+        return;
+
+      if (worker != 0)
+        --(*master.busy_.access());
+      else
+      {
+        // keep the communication going, while the other workers finish their last blocks
+        while (*master.busy_.const_access() > 0)
+        {
+          master.comm_progress(out_queues_limit);
+          this_thread::yield();
         }
-      } while(true);
+        master.comm_progress(out_queues_limit);
+      }
+    }
 
-      // TODO: invoke opportunistic communication
-      //       don't forget to adjust Master::exchange()
+    // make room for block i among the blocks this worker keeps in memory
+    void    keep(int i, std::vector<int>& local)
+    {
+      if (local.size() == local_limit)                            // reached the local limit
+      {
+        if (master.eviction_)
+        {
+          int victim = master.evict(local);
+          local.erase(std::find(local.begin(), local.end(), victim));
+          master.unload(victim);
+        } else
+          master.unload(local);
+      }
+      local.push_back(i);
     }
 
-    static void run(void* bf)                   { static_cast<ProcessBlock*>(bf)->process(); }
+    static void run(void* bf, int worker)       { static_cast<ProcessBlock*>(bf)->process(worker); }
 
     const Functor&          f;
     const Skip&             skip;
     void*                   aux;
     Master&                 master;
-    const std::deque<int>&  blocks;
     int                     local_limit;
-    critical_resource<int>& idx;
+    detail::WorkQueues&     queues;
+    size_t                  out_queues_limit;
+    int                     prefetch;           // blocks to load ahead (0 = none)
+    bool                    shared;             // the workers share the limit (see EvictionPolicy)
+    int                     reserve;            // room to leave for the prefetched blocks, with a shared limit
+    bool                    hand_off;           // pass the queues of the finished blocks to the main thread
+    bool                    communicate;        // the main thread advances communication in between blocks
   };
 
   struct Master::SkipNoIncoming
@@ -396,6 +771,7 @@ unload(int i)
 {
   //fprintf(stdout, "Unloading block: %d\n", gid(i));
 
+  materialize(outgoing_[gid(i)]);       // the references may point into the block
   blocks_.unload(i);
   unload_queues(i);
 }
@@ -413,6 +789,9 @@ diy::Master::
 unload_incoming(int gid)
 {
   IncomingQueuesRecords& in_qrs = incoming_[gid];
+  if (in_qrs.viewed)
+    return;                 // views from dequeue_view() point into the queues
+
   for (InQueueRecords::iterator it = in_qrs.records.begin(); it != in_qrs.records.end(); ++it)
   {
     QueueRecord& qr = it->second;
@@ -431,51 +810,79 @@ unload_outgoing(int gid)
   OutgoingQueuesRecord& out_qr = outgoing_[gid];
 
   size_t out_queues_size = sizeof(size_t);   // map size
-  size_t count = 0;
   for (OutgoingQueues::iterator it = out_qr.queues.begin(); it != out_qr.queues.end(); ++it)
   {
     if (it->first.proc == comm_.rank()) continue;
 
-    out_queues_size += sizeof(BlockID);     // target
-    out_queues_size += sizeof(size_t);      // buffer.position
-    out_queues_size += sizeof(size_t);      // buffer.size
-    out_queues_size += it->second.size();   // buffer contents
-    ++count;
+    out_queues_size += serialized_size(it->first);
+    out_queues_size += serialized_size(it->second);
   }
+  for (OutgoingReferences::iterator it = out_qr.references.begin(); it != out_qr.references.end(); ++it)
+    if (it->first.proc != comm_.rank())
+      out_queues_size += references_size(&it->second);
   if (queue_policy_->unload_outgoing(*this, gid, out_queues_size - sizeof(size_t)))
   {
-      //fprintf(stderr, "Unloading outgoing queues: %d -> ...; size = %lu\n", gid, out_queues_size);
-      MemoryBuffer  bb;     bb.reserve(out_queues_size);
-      diy::save(bb, count);
+      materialize(out_qr);      // storage can't hold on to the caller's arrays
 
+      //fprintf(stderr, "Unloading outgoing queues: %d -> ...; size = %lu\n", gid, out_queues_size);
       for (OutgoingQueues::iterator it = out_qr.queues.begin(); it != out_qr.queues.end();)
       {
-        if (it->first.proc == comm_.rank())
+        if (it->first.proc == comm_.rank() &&
+            queue_policy_->unload_incoming(*this, gid, it->first.gid, it->second.size()))
         {
           // treat as incoming
-          if (queue_policy_->unload_incoming(*this, gid, it->first.gid, it->second.size()))
-          {
-            QueueRecord& qr = out_qr.external_local[it->first];
-            qr.size = it->second.size();
-            qr.external = storage_->put(it->second);
-
-            out_qr.queues.erase(it++);
-            continue;
-          } // else keep in memory
-        } else
-        {
-          diy::save(bb, it->first);
-          diy::save(bb, it->second);
+          QueueRecord& qr = out_qr.external_local[it->first];
+          qr.size = it->second.size();
+          qr.external = storage_->put(it->second);
 
           out_qr.queues.erase(it++);
-          continue;
-        }
-        ++it;
+        } else
+          ++it;     // local queues that stay in memory; the remote ones are saved below
       }
 
-      // TODO: this mechanism could be adjusted for direct saving to disk
-      //       (without intermediate binary buffer serialization)
-      out_qr.external = storage_->put(bb);
+      // the storage serializes the remote queues one by one, straight into its own buffers
+      RemoteQueues remote = { &out_qr.queues, comm_.rank() };
+      out_qr.size     = out_queues_size;
+      out_qr.external = storage_->put(&remote, &save_remote_queues);
+
+      for (OutgoingQueues::iterator it = out_qr.queues.begin(); it != out_qr.queues.end();)
+        if (it->first.proc != comm_.rank())
+          out_qr.queues.erase(it++);
+        else
+          ++it;
+  }
+}
+
+void
+diy::Master::
+save_remote_queues(const void* x, BinaryBuffer& bb)
+{
+  const RemoteQueues& remote = *static_cast<const RemoteQueues*>(x);
+  size_t count = 0;
+  for (OutgoingQueues::const_iterator it = remote.queues->begin(); it != remote.queues->end(); ++it)
+    if (it->first.proc != remote.rank)
+      ++count;
+  diy::save(bb, count);
+  for (OutgoingQueues::const_iterator it = remote.queues->begin(); it != remote.queues->end(); ++it)
+    if (it->first.proc != remote.rank)
+    {
+      diy::save(bb, it->first);
+      diy::save(bb, it->second);
+    }
+}
+
+void
+diy::Master::
+load_remote_queues(void* x, BinaryBuffer& bb)
+{
+  OutgoingQueues& queues = *static_cast<OutgoingQueues*>(x);
+  size_t count;
+  diy::load(bb, count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    BlockID to;
+    diy::load(bb, to);
+    diy::load(bb, queues[to]);
   }
 }
 
@@ -485,7 +892,13 @@ load(int i)
 {
   //fprintf(stdout, "Loading block: %d\n", gid(i));
 
+  double start = detail::Placement::now();
   blocks_.load(i);
+  if (eviction_)
+  {
+    lock_guard<fast_mutex>  lock(eviction_mutex_);
+    eviction_->loaded(i, detail::Placement::now() - start);
+  }
   load_queues(i);
 }
 
@@ -516,25 +929,12 @@ load_incoming(int gid)
 
 void
 diy::Master::
-load_outgoing(int gid)
+load_outgoing(OutgoingQueuesRecord& out_qr)
 {
-  // TODO: we could adjust this mechanism to read directly from storage,
-  //       bypassing an intermediate MemoryBuffer
-  OutgoingQueuesRecord& out_qr = outgoing_[gid];
   if (out_qr.external != -1)
   {
-    MemoryBuffer bb;
-    storage_->get(out_qr.external, bb);
+    storage_->get(out_qr.external, &out_qr.queues, &load_remote_queues);
     out_qr.external = -1;
-
-    size_t count;
-    diy::load(bb, count);
-    for (size_t i = 0; i < count; ++i)
-    {
-      BlockID to;
-      diy::load(bb, to);
-      diy::load(bb, out_qr.queues[to]);
-    }
   }
 }
 
@@ -549,7 +949,17 @@ diy::Master::
 add(int gid, void* b, Link* l)
 {
   if (*blocks_.in_memory().const_access() == limit_)
-    unload_all();
+  {
+    if (eviction_)
+    {
+      std::vector<int> loaded;
+      for (unsigned i = 0; i < size(); ++i)
+        if (block(i) != 0)
+          loaded.push_back(i);
+      unload(evict(loaded));
+    } else
+      unload_all();
+  }
 
   lock_guard<fast_mutex>    lock(add_mutex_);       // allow to add blocks from multiple threads
 
@@ -593,6 +1003,18 @@ void
 diy::Master::
 foreach(const Functor& f, const Skip& skip, void* aux)
 {
+  // a block's queues go out only once per exchange, so only the foreach right before it may send them early
+  bool early  = send_early_ && !exchanging_;
+  send_early_ = false;
+
+  // the views dequeued in the previous foreach expire
+  viewed_.access()->clear();
+  for (IncomingQueuesMap::iterator it = incoming_.begin(); it != incoming_.end(); ++it)
+  {
+    it->second.retired.clear();
+    it->second.viewed = false;
+  }
+
   // touch the outgoing and incoming queues as well as collectives to make sure they exist
   for (unsigned i = 0; i < size(); ++i)
   {
@@ -624,39 +1046,60 @@ foreach(const Functor& f, const Skip& skip, void* aux)
     blocks_per_thread = limit_/num_threads;
   }
 
-  // idx is shared
-  critical_resource<int> idx(0);
+  // each worker starts with its own share of the blocks and steals from the others when done
+  detail::WorkQueues      queues(num_threads);
+  queues.fill(blocks);
+
+  // when sending early, bound the sends in between blocks the same way flush() does
+  size_t out_queues_limit = (limit_ == -1) ? size() : std::max(1, limit_);
+  *busy_.access() = num_threads - 1;
+
+  // the prefetched blocks take up some of each worker's share of the limit
+  int prefetch = (limit_ == -1 || !storage_) ? 0 : std::min(prefetch_, blocks_per_thread - 1);
+  if (prefetch)
+    prefetcher_.start(&Master::prefetch_load, this, size());
 
   typedef                 ProcessBlock<Block,Functor,Skip>                BlockFunctor;
-  if (num_threads > 1)
+  BlockFunctor            bf(f, skip, aux, *this, blocks_per_thread - prefetch, queues, out_queues_limit, prefetch, early);
+  pool_.run(&BlockFunctor::run, &bf, num_threads);
+
+  if (prefetch)
+    prefetcher_.finish();
+
+  if (eviction_ && eviction_->shared)
   {
-    // launch the threads
-    typedef               std::pair<thread*, BlockFunctor*>               ThreadFunctorPair;
-    typedef               std::list<ThreadFunctorPair>                    ThreadFunctorList;
-    ThreadFunctorList     threads;
-    for (unsigned i = 0; i < num_threads; ++i)
+    // workers may have loaded blocks at the same time, before any could be evicted
+    while (in_memory() > limit_ && !evictable_.empty())
     {
-        BlockFunctor* bf = new BlockFunctor(f, skip, aux, *this, blocks, blocks_per_thread, idx);
-        threads.push_back(ThreadFunctorPair(new thread(&BlockFunctor::run, bf), bf));
+      int victim = evict(evictable_);
+      evictable_.erase(std::find(evictable_.begin(), evictable_.end(), victim));
+      unload(victim);
     }
+    evictable_.clear();
+  }
 
-    // join the threads
-    for(typename ThreadFunctorList::iterator it = threads.begin(); it != threads.end(); ++it)
+  // clear incoming queues, unless they are still arriving
+  if (!exchanging_)
+    clear_incoming();
+
+  if (early)
+  {
+    // return the queues we didn't get to send to their blocks; exchange() will take care of them
+    ReadyList& ready = *ready_.access();
+    for (ReadyList::iterator it = ready.begin(); it != ready.end(); ++it)
     {
-        thread*           t  = it->first;
-        BlockFunctor*     bf = it->second;
-        t->join();
-        delete t;
-        delete bf;
+      int gid = it->first;
+      OutgoingQueuesRecord& out = outgoing_[gid];
+      if (out.external != -1)
+        load_outgoing(gid);
+      out.queues.swap(it->second.queues);
+      out.external_local.swap(it->second.external_local);
+      out.references.swap(it->second.references);
     }
-  } else
-  {
-      BlockFunctor bf(f, skip, aux, *this, blocks, blocks_per_thread, idx);
-      BlockFunctor::run(&bf);
-  }
+    ready.clear();
 
-  // clear incoming queues
-  incoming_.clear();
+    // the queues received early stay in early_incoming_ until the exchange they belong to ends
+  }
 
   if (limit() != -1 && in_memory() > limit())
   {
@@ -667,192 +1110,979 @@ foreach(const Functor& f, const Skip& skip, void* aux)
 
 void
 diy::Master::
-exchange()
+start_exchange(bool gather)
 {
   //fprintf(stdout, "Starting exchange\n");
 
+  // the queues of the previous exchange that no foreach consumed; in sparse mode, only the ranks that
+  // send this time replace their queues, so the rest must not be left to pass for new ones
+  clear_incoming();
+
   // make sure there is a queue for each neighbor
-  for (int i = 0; i < size(); ++i)
+  for (unsigned i = 0; i < size() && !sparse_; ++i)
   {
-    OutgoingQueues&  outgoing_queues  = outgoing_[gid(i)].queues;
-    OutQueueRecords& external_local   = outgoing_[gid(i)].external_local;
-    if (outgoing_queues.size() < link(i)->size())
-      for (unsigned j = 0; j < link(i)->size(); ++j)
-      {
-        if (external_local.find(link(i)->target(j)) == external_local.end())
-          outgoing_queues[link(i)->target(j)];        // touch the outgoing queue, creating it if necessary
-      }
+    if (flushed_.find(gid(i)) != flushed_.end())
+      continue;                                       // already sent during foreach
+    touch_outgoing(i);
   }
 
-  flush();
+  flush_begin(gather);
+}
+
+void
+diy::Master::
+exchange_end()
+{
+  flush_end();
   //fprintf(stdout, "Finished exchange\n");
 }
 
 /* Communicator */
 void
 diy::Master::
-comm_exchange(ToSendList& to_send, int out_queues_limit)
+comm_exchange(ToSendList& to_send, size_t out_queues_limit, OutgoingQueuesMap& outgoing, IncomingQueuesMap& incoming)
 {
-  // isend outgoing queues, up to the out_queues_limit
+  // isend outgoing queues, up to the out_queues_limit and the inflight budget
   while(inflight_size_ < out_queues_limit && !to_send.empty())
   {
     int from = to_send.front();
 
-    // deal with external_local queues
-    for (OutQueueRecords::iterator it = outgoing_[from].external_local.begin(); it != outgoing_[from].external_local.end(); ++it)
+    OutgoingQueuesRecord& out = outgoing[from];
+    if (!within_budget(out))
     {
-      int to = it->first.gid;
+      send_packed_queues();     // let go of whatever was packed so far, to make room
+      break;
+    }
+    if (out.external != -1)
+      load_outgoing(out);
+    to_send.pop_front();
 
-      //fprintf(stderr, "Processing local queue: %d <- %d\n", to, from);
-      //fprintf(stderr, "   size:    %lu\n",     it->second.size);
+    send_outgoing_queues(from, out, incoming);
+  }
 
-      QueueRecord& in_qr  = incoming_[to].records[from];
-      bool in_external  = block(lid(to)) == 0;
+  if (to_send.empty())
+    send_packed_queues();
 
-      if (in_external)
-          in_qr = it->second;
-      else
-      {
-          // load the queue
-          in_qr.size     = it->second.size;
-          in_qr.external = -1;
+  // kick requests
+  while(nudge());
 
-          MemoryBuffer bb;
-          storage_->get(it->second.external, bb);
+  // check incoming queues
+  receive_queues(incoming);
+}
 
-          incoming_[to].queues[from].swap(bb);
-      }
-      ++received_;
+void
+diy::Master::
+send_outgoing_queues(int from, OutgoingQueuesRecord& out, IncomingQueuesMap& incoming)
+{
+  // deal with external_local queues
+  for (OutQueueRecords::iterator it = out.external_local.begin(); it != out.external_local.end(); ++it)
+  {
+    int to = it->first.gid;
+
+    //fprintf(stderr, "Processing local queue: %d <- %d\n", to, from);
+    //fprintf(stderr, "   size:    %lu\n",     it->second.size);
+
+    if (sparse_ && it->second.size == 0)
+    {
+      storage_->destroy(it->second.external);
+      continue;
     }
-    outgoing_[from].external_local.clear();
 
-    if (outgoing_[from].external != -1)
-      load_outgoing(from);
-    to_send.pop_front();
+    QueueRecord& in_qr  = incoming[to].records[from];
+    bool in_external  = block(lid(to)) == 0;
 
-    OutgoingQueues& outgoing = outgoing_[from].queues;
-    for (OutgoingQueues::iterator it = outgoing.begin(); it != outgoing.end(); ++it)
+    if (in_external)
+        in_qr = it->second;
+    else
     {
-      BlockID to_proc = it->first;
-      int     to      = to_proc.gid;
-      int     proc    = to_proc.proc;
+        // load the queue
+        in_qr.size     = it->second.size;
+        in_qr.external = -1;
 
-      //fprintf(stderr, "Processing queue: %d <- %d\n", to, from);
-      //fprintf(stderr, "   size:    %lu\n",     outgoing_[from].queues[to_proc].size());
+        MemoryBuffer bb;
+        storage_->get(it->second.external, bb);
 
-      // There may be local outgoing queues that remained in memory
-      if (proc == comm_.rank())     // sending to ourselves: simply swap buffers
-      {
-        //fprintf(stderr, "Moving queue in-place: %d <- %d\n", to, from);
+        incoming[to].queues[from].swap(bb);
+    }
+    ++received_;
+  }
+  out.external_local.clear();
 
-        QueueRecord& in_qr  = incoming_[to].records[from];
-        bool in_external  = block(lid(to)) == 0;
-        if (in_external)
-        {
-          //fprintf(stderr, "Unloading outgoing directly as incoming: %d <- %d\n", to, from);
-          MemoryBuffer& bb = it->second;
-          in_qr.size = bb.size();
-          if (queue_policy_->unload_incoming(*this, from, to, in_qr.size))
-            in_qr.external = storage_->put(bb);
-          else
-          {
-            MemoryBuffer& in_bb = incoming_[to].queues[from];
-            in_bb.swap(bb);
-            in_bb.reset();
-            in_qr.external = -1;
-          }
-        } else        // !in_external
+  OutgoingQueues& outgoing = out.queues;
+  for (OutgoingQueues::iterator it = outgoing.begin(); it != outgoing.end(); ++it)
+  {
+    BlockID to_proc = it->first;
+    int     to      = to_proc.gid;
+    int     proc    = to_proc.proc;
+
+    //fprintf(stderr, "Processing queue: %d <- %d\n", to, from);
+    //fprintf(stderr, "   size:    %lu\n",     it->second.size());
+
+    OutgoingReferences::iterator    refs = out.references.find(to_proc);
+    References*                     queue_refs = (refs == out.references.end() || refs->second.empty()) ? 0 : &refs->second;
+
+    if (sparse_ && it->second.empty() && !queue_refs)
+      continue;
+
+    // only a remote send can gather the referenced data in place (and only if it doesn't need to compress it)
+    if (queue_refs && (proc == comm_.rank() || aggregate_ || codec_))
+    {
+      materialize(it->second, *queue_refs);
+      queue_refs = 0;
+    }
+
+    // There may be local outgoing queues that remained in memory
+    if (proc == comm_.rank())     // sending to ourselves: simply swap buffers
+    {
+      //fprintf(stderr, "Moving queue in-place: %d <- %d\n", to, from);
+
+      QueueRecord& in_qr  = incoming[to].records[from];
+      bool in_external  = block(lid(to)) == 0;
+      if (in_external)
+      {
+        //fprintf(stderr, "Unloading outgoing directly as incoming: %d <- %d\n", to, from);
+        MemoryBuffer& bb = it->second;
+        in_qr.size = bb.size();
+        if (queue_policy_->unload_incoming(*this, from, to, in_qr.size))
+          in_qr.external = storage_->put(bb);
+        else
         {
-          //fprintf(stderr, "Swapping in memory: %d <- %d\n", to, from);
-          MemoryBuffer& bb = incoming_[to].queues[from];
-          bb.swap(it->second);
-          bb.reset();
-          in_qr.size = bb.size();
+          MemoryBuffer& in_bb = incoming[to].queues[from];
+          in_bb.swap(bb);
+          in_bb.reset();
           in_qr.external = -1;
         }
+      } else        // !in_external
+      {
+        //fprintf(stderr, "Swapping in memory: %d <- %d\n", to, from);
+        MemoryBuffer& bb = incoming[to].queues[from];
+        bb.swap(it->second);
+        bb.reset();
+        in_qr.size = bb.size();
+        in_qr.external = -1;
+      }
+
+      ++received_;
+      continue;
+    }
+
+    if (codec_)
+      detail::encode(*codec_, codec_threshold_, it->second);
+
+    if (aggregate_)
+    {
+      // frame: from, to, queue
+      MemoryBuffer& packed = packed_[proc];
+      size_t        before = packed.size();
+      diy::save(packed, from);
+      diy::save(packed, to);
+      diy::save(packed, it->second);
+      packed_bytes_ += packed.size() - before;
+      it->second.wipe();
+      continue;
+    }
+
+    MemoryBuffer bb;
+    bb.swap(it->second);
+    diy::save(bb, std::make_pair(from, to));
+    size_t size = bb.size() + references_size(queue_refs);
 
-        ++received_;
-        continue;
+    int t = tags::queue;
+    if (prepost_ && size <= chunk_size_)
+    {
+      Traffic& credit = credits_[proc];
+      if (credit.messages > 0 && size <= credit.largest)
+      {
+        --credit.messages;
+        t = tags::preposted_queue;
       }
 
+      Traffic& sent = sent_[proc];
+      ++sent.messages;
+      sent.largest = std::max(sent.largest, size);
+    }
+    post_send(proc, t, bb, from, to, queue_refs);
+  }
+  out.references.clear();
+}
+
+void
+diy::Master::
+send_packed_queues()
+{
+  for (PackedQueues::iterator it = packed_.begin(); it != packed_.end(); ++it)
+    post_send(it->first, tags::packed_queues, it->second, -1, -1);     // many blocks
+  packed_.clear();
+  packed_bytes_ = 0;
+}
+
+void
+diy::Master::
+post_send(int proc, int t, MemoryBuffer& bb, int from, int to, References* refs)
+{
+  inflight_.push_back(InFlight()); ++inflight_size_;
+  InFlight& m = inflight_.back();
+  m.from = from;
+  m.to   = to;
+
+  if (refs && bb.size() + references_size(refs) <= chunk_size_)
+  {
+    // gather the queue's own pieces and the caller's arrays into one message, without packing them
+    m.message.swap(bb);
+    mpi::gather_list g;
+    size_t      last = 0;
+    for (size_t i = 0; i < refs->size(); ++i)
+    {
+      const Reference& r = (*refs)[i];
+      g.add(&m.message.buffer[0] + last, r.offset - last);
+      g.add(r.data, r.size);
+      last = r.offset;
+    }
+    g.add(&m.message.buffer[0] + last, m.message.size() - last);
+
+    if (sparse_)
+      inflight_requests_.push_back(exchange_comm_.issend(proc, tag(t), g));
+    else
+      inflight_requests_.push_back(exchange_comm_.isend(proc, tag(t), g));
+    inflight_bytes_ += m.message.size();           // the references are the caller's memory
+    return;
+  }
+
+  if (refs)
+    materialize(bb, *refs);
+
+  if (bb.size() <= chunk_size_)
+  {
+    m.message.swap(bb);
+    inflight_requests_.push_back(send_queue(proc, tag(t), m.message));
+    inflight_bytes_ += m.message.size();
+    return;
+  }
+
+  // large message: send a header, followed by the pieces (see send_chunks())
+  chunked_.push_back(Chunked());
+  Chunked& c = chunked_.back();
+  c.message.swap(bb);
+  c.proc    = proc;
+  c.sent    = 0;
+  c.pending = 0;
+  inflight_bytes_ += c.message.size();
+
+  diy::save(m.message, t);
+  diy::save(m.message, c.message.size());
+  diy::save(m.message, chunk_size_);
+  inflight_requests_.push_back(send_queue(proc, tag(tags::chunked_header), m.message));
+  inflight_bytes_ += m.message.size();
+
+  send_chunks();
+}
+
+size_t
+diy::Master::
+references_size(const References* refs)
+{
+  size_t size = 0;
+  if (refs)
+    for (size_t i = 0; i < refs->size(); ++i)
+      size += (*refs)[i].size;
+  return size;
+}
+
+void
+diy::Master::
+materialize(MemoryBuffer& bb, References& refs)
+{
+  if (refs.empty())
+    return;
+
+  MemoryBuffer  result;
+  result.buffer.resize(bb.size() + references_size(&refs));
+
+  char*         dest = result.buffer.empty() ? 0 : &result.buffer[0];
+  size_t        last = 0;
+  for (size_t i = 0; i < refs.size(); ++i)
+  {
+    const Reference& r = refs[i];
+    dest = std::copy(bb.buffer.begin() + last, bb.buffer.begin() + r.offset, dest);
+    dest = std::copy(r.data, r.data + r.size, dest);
+    last = r.offset;
+  }
+  std::copy(bb.buffer.begin() + last, bb.buffer.end(), dest);
+
+  result.position = bb.position + references_size(&refs);
+  bb.swap(result);
+  refs.clear();
+}
+
+void
+diy::Master::
+materialize(OutgoingQueuesRecord& out)
+{
+  for (OutgoingReferences::iterator it = out.references.begin(); it != out.references.end(); ++it)
+    materialize(out.queues[it->first], it->second);
+  out.references.clear();
+}
+
+void
+diy::Master::
+send_chunks()
+{
+  // the receiver posts the receives for the pieces in the order of the headers,
+  // so the pieces of the messages bound for the same rank must follow the same order
+  std::set<int>     blocked;
+  for (ChunkedList::iterator it = chunked_.begin(); it != chunked_.end(); ++it)
+  {
+    Chunked& c = *it;
+    if (blocked.find(c.proc) != blocked.end())
+      continue;
+
+    while (c.pending < chunks_in_flight_ && c.sent < c.message.size())
+    {
+      int count = std::min(chunk_size_, c.message.size() - c.sent);
+
       inflight_.push_back(InFlight()); ++inflight_size_;
-      inflight_.back().from = from;
-      inflight_.back().to   = to;
-      MemoryBuffer& bb = inflight_.back().message;
-      bb.swap(it->second);
-      diy::save(bb, std::make_pair(from, to));
-      inflight_.back().request = comm_.isend(proc, tags::queue, bb.buffer);
+      inflight_.back().chunked = &c;
+      inflight_.back().from    = -1;
+      inflight_.back().to      = -1;
+      if (sparse_)
+        inflight_requests_.push_back(exchange_comm_.issend(c.proc, tag(tags::chunk), &c.message.buffer[c.sent], count));
+      else
+        inflight_requests_.push_back(exchange_comm_.isend(c.proc, tag(tags::chunk), &c.message.buffer[c.sent], count));
+
+      c.sent += count;
+      ++c.pending;
     }
+
+    if (c.sent < c.message.size())
+      blocked.insert(c.proc);
   }
+}
 
-  // kick requests
-  while(nudge());
+diy::mpi::request
+diy::Master::
+send_queue(int proc, int tag, MemoryBuffer& bb)
+{
+  if (sparse_)
+    return exchange_comm_.issend(proc, tag, bb.buffer);     // completes only once matched, which is what lets ibarrier detect termination
+  else
+    return exchange_comm_.isend(proc, tag, bb.buffer);
+}
 
-  // check incoming queues
-  mpi::optional<mpi::status>        ostatus = comm_.iprobe(mpi::any_source, tags::queue);
-  while(ostatus)
+void
+diy::Master::
+receive_queues(IncomingQueuesMap& incoming)
+{
+  // matched probes receive each message straight into a recycled buffer;
+  // preposted_queue messages show up here only if the receiver didn't post a receive for them (see post_receives())
+  int                               t        = tags::queue;
+  mpi::optional<mpi::message>       omessage = exchange_comm_.improbe(mpi::any_source, tag(t));
+  while(omessage || t == tags::queue)
   {
+    if (!omessage)
+    {
+      t = tags::preposted_queue;
+      omessage = exchange_comm_.improbe(mpi::any_source, tag(t));
+      continue;
+    }
+
     MemoryBuffer bb;
-    comm_.recv(ostatus->source(), tags::queue, bb.buffer);
+    reuse_buffer(bb);
+    comm_.mrecv(*omessage, bb.buffer);
 
+    if (prepost_)
+    {
+      Traffic& received = received_from_[omessage->source()];
+      ++received.messages;
+      received.largest = std::max(received.largest, bb.size());
+    }
+
+    receive_message(tags::queue, bb, incoming);
+
+    omessage = exchange_comm_.improbe(mpi::any_source, tag(t));
+  }
+
+  // aggregated messages
+  omessage = exchange_comm_.improbe(mpi::any_source, tag(tags::packed_queues));
+  while(omessage)
+  {
+    MemoryBuffer bb;
+    reuse_buffer(bb);
+    comm_.mrecv(*omessage, bb.buffer);
+    receive_message(tags::packed_queues, bb, incoming);
+
+    omessage = exchange_comm_.improbe(mpi::any_source, tag(tags::packed_queues));
+  }
+
+  // large messages
+  receive_chunked(incoming);
+
+  // completed preposted receives
+  if (preposted_.empty() || mpi::test_some(preposted_requests_, completed_, statuses_) == 0)
+    return;
+
+  for (unsigned i = 0; i < completed_.size(); ++i)
+  {
+    Preposted& p = preposted_[completed_[i]];
+    preposted_bytes_ -= p.size;
+    MemoryBuffer& bb = p.message;
+    bb.buffer.resize(statuses_[i].count<char>());
+
+    Traffic& received = received_from_[p.source];
+    ++received.messages;
+    received.largest = std::max(received.largest, bb.size());
+
+    receive_message(tags::queue, bb, incoming);
+  }
+  remove_completed(preposted_, preposted_requests_, completed_);
+}
+
+void
+diy::Master::
+receive_message(int t, MemoryBuffer& bb, IncomingQueuesMap& incoming)
+{
+  if (t == tags::packed_queues)
+  {
+    // split up the aggregated queues
+    while(bb)
+    {
+      int from, to;
+      diy::load(bb, from);
+      diy::load(bb, to);
+
+      MemoryBuffer queue;
+      reuse_buffer(queue);
+      diy::load(bb, queue);
+      receive_queue(from, to, queue, incoming);
+    }
+    recycle_buffer(bb);
+  } else
+  {
     std::pair<int,int> from_to;
     diy::load_back(bb, from_to);
-    int from = from_to.first;
-    int to   = from_to.second;
+    receive_queue(from_to.first, from_to.second, bb, incoming);
+  }
+}
 
-    int size     = bb.size();
-    int external = -1;
+void
+diy::Master::
+receive_chunked(IncomingQueuesMap& incoming)
+{
+  // headers: post the receives for all the pieces straight into the reassembled buffer
+  mpi::optional<mpi::message>       omessage = exchange_comm_.improbe(mpi::any_source, tag(tags::chunked_header));
+  while(omessage)
+  {
+    MemoryBuffer header;
+    comm_.mrecv(*omessage, header.buffer);
+
+    reassembling_.push_back(Reassembly());
+    Reassembly& r = reassembling_.back();
+    size_t size, chunk_size;
+    diy::load(header, r.tag);
+    diy::load(header, size);
+    diy::load(header, chunk_size);
+
+    r.message.buffer.resize(size);
+    for (size_t offset = 0; offset < size; offset += chunk_size)
+      r.requests.push_back(exchange_comm_.irecv(omessage->source(), tag(tags::chunk),
+                                       &r.message.buffer[offset], (int) std::min(chunk_size, size - offset)));
+    r.remaining = r.requests.size();
+
+    omessage = exchange_comm_.improbe(mpi::any_source, tag(tags::chunked_header));
+  }
 
-    incoming_[to].queues[from] = MemoryBuffer();
-    if (block(lid(to)) != 0 || !queue_policy_->unload_incoming(*this, from, to, size))
+  // messages whose pieces have all arrived
+  for (ReassemblyList::iterator it = reassembling_.begin(); it != reassembling_.end();)
+  {
+    it->remaining -= mpi::test_some(it->requests, completed_, statuses_);
+    if (it->remaining == 0)
     {
-        incoming_[to].queues[from].swap(bb);
-        incoming_[to].queues[from].reset();     // buffer position = 0
-    } else if (queue_policy_->unload_incoming(*this, from, to, size))
+      receive_message(it->tag, it->message, incoming);
+      reassembling_.erase(it++);
+    } else
+      ++it;
+  }
+}
+
+void
+diy::Master::
+finish_reassembly(IncomingQueuesMap& incoming)
+{
+  // in sparse mode the exchange may end with pieces still landing (their sends are done once matched)
+  for (ReassemblyList::iterator it = reassembling_.begin(); it != reassembling_.end(); ++it)
+  {
+    mpi::wait_all(it->requests);
+    receive_message(it->tag, it->message, incoming);
+  }
+  reassembling_.clear();
+}
+
+void
+diy::Master::
+finish_preposted(IncomingQueuesMap& incoming)
+{
+  // the receives nobody sent to; one may still have been matched at the last moment
+  for (unsigned i = 0; i < preposted_requests_.size(); ++i)
+    preposted_requests_[i].cancel();
+  mpi::wait_all(preposted_requests_, statuses_);
+
+  for (unsigned i = 0; i < preposted_.size(); ++i)
+  {
+    Preposted& p = preposted_[i];
+    if (statuses_[i].cancelled())
     {
-        //fprintf(stderr, "Directly unloading queue %d <- %d\n", to, from);
-        external = storage_->put(bb);           // unload directly
+      recycle_buffer(p.message);
+      continue;
     }
-    incoming_[to].records[from] = QueueRecord(size, external);
 
-    ++received_;
+    MemoryBuffer& bb = p.message;
+    bb.buffer.resize(statuses_[i].count<char>());
+
+    Traffic& received = received_from_[p.source];
+    ++received.messages;
+    received.largest = std::max(received.largest, bb.size());
 
-    ostatus = comm_.iprobe(mpi::any_source, tags::queue);
+    std::pair<int,int> from_to;
+    diy::load_back(bb, from_to);
+    receive_queue(from_to.first, from_to.second, bb, incoming);
   }
+  preposted_.clear();
+  preposted_requests_.clear();
+  preposted_bytes_ = 0;
 }
 
 void
 diy::Master::
-flush()
+cancel_requests()
 {
-#ifdef DEBUG
-  time_type start = get_time();
-  unsigned wait = 1;
-#endif
+  // a receive may still have been matched at the last moment; its queue is dropped with the rest
+  for (unsigned i = 0; i < preposted_requests_.size(); ++i)
+    preposted_requests_[i].cancel();
+  mpi::wait_all(preposted_requests_);
+
+  preposted_.clear();
+  preposted_requests_.clear();
+  preposted_bytes_ = 0;
+}
+
+void
+diy::Master::
+post_receives()
+{
+  // called once the exchange is over: whatever the ranks sent each other this time
+  // is what they expect to send next time
+  credits_.clear();
+  if (prepost_)
+  {
+    credits_.swap(sent_);
+
+    // within the inflight budget; the senders don't know about it, so the messages
+    // without a receive are picked up by receive_queues() under the same tag
+    for (TrafficMap::const_iterator it = received_from_.begin(); it != received_from_.end(); ++it)
+      for (int i = 0; i < it->second.messages; ++i)
+      {
+        if (inflight_budget_ && preposted_bytes_ + it->second.largest > inflight_budget_)
+          break;
+
+        preposted_.push_back(Preposted());
+        Preposted& p = preposted_.back();
+        p.source = it->first;
+        p.size   = it->second.largest;
+        preposted_bytes_ += p.size;
+        reuse_buffer(p.message);
+        p.message.buffer.resize(p.size);
+        preposted_requests_.push_back(exchange_comm_.irecv(p.source, tag(tags::preposted_queue), p.message.buffer));
+      }
+  }
+  sent_.clear();
+  received_from_.clear();
+}
+
+void
+diy::Master::
+reuse_buffer(MemoryBuffer& bb)
+{
+  if (spare_buffers_.empty())
+    return;
+
+  bb.buffer.swap(spare_buffers_.front());
+  spare_buffers_.pop_front();
+  bb.clear();
+}
+
+size_t
+diy::Master::
+outgoing_size(const OutgoingQueuesRecord& out) const
+{
+  size_t size = (out.external != -1) ? out.size : 0;
+  for (OutgoingQueues::const_iterator it = out.queues.begin(); it != out.queues.end(); ++it)
+    if (it->first.proc != comm_.rank())
+      size += it->second.size();
+  for (OutgoingReferences::const_iterator it = out.references.begin(); it != out.references.end(); ++it)
+    if (it->first.proc != comm_.rank())
+      size += references_size(&it->second);
+  return size;
+}
+
+bool
+diy::Master::
+within_budget(const OutgoingQueuesRecord& out) const
+{
+  if (inflight_budget_ == 0 || (inflight_.empty() && packed_.empty()))      // always make progress
+    return true;
+  return inflight_bytes() + outgoing_size(out) <= inflight_budget_;
+}
+
+void
+diy::Master::
+recycle_buffer(MemoryBuffer& bb)
+{
+  static const size_t max_spare_buffers = 64;
+  if (spare_buffers_.size() >= max_spare_buffers || bb.buffer.capacity() == 0 || bb.buffer.capacity() > chunk_size_)
+    return;
+
+  spare_buffers_.push_back(std::vector<char>());
+  spare_buffers_.back().swap(bb.buffer);
+  bb.reset();
+}
+
+void
+diy::Master::
+receive_queue(int from, int to, MemoryBuffer& bb, IncomingQueuesMap& incoming)
+{
+  if (codec_)
+    detail::decode(*codec_, bb);
+
+  size_t size     = bb.size();
+  int    external = -1;
+
+  incoming[to].queues[from] = MemoryBuffer();
+  if (block(lid(to)) != 0 || !queue_policy_->unload_incoming(*this, from, to, size))
+  {
+      incoming[to].queues[from].swap(bb);
+      incoming[to].queues[from].reset();     // buffer position = 0
+  } else if (queue_policy_->unload_incoming(*this, from, to, size))
+  {
+      //fprintf(stderr, "Directly unloading queue %d <- %d\n", to, from);
+      external = storage_->put(bb);           // unload directly
+  }
+  incoming[to].records[from] = QueueRecord(size, external);
+
+  ++received_;
+}
+
+void
+diy::Master::
+ready(int i)
+{
+  int                   gid = this->gid(i);
+  OutgoingQueuesRecord& out = outgoing_[gid];
+
+  // make sure there is a queue for each neighbor (see start_exchange())
+  if (!sparse_)
+    touch_outgoing(i);
+
+  // the queues go out while foreach goes on, and may unload the block
+  if (limit_ != -1)
+    materialize(out);
+
+  critical_resource<ReadyList>::accessor ready = ready_.access();
+  ready->push_back(std::make_pair(gid, OutgoingQueuesRecord()));
+  ready->back().second.queues.swap(out.queues);
+  ready->back().second.external_local.swap(out.external_local);
+  ready->back().second.references.swap(out.references);
+}
+
+void
+diy::Master::
+touch_outgoing(int i)
+{
+  OutgoingQueuesRecord& out = outgoing_[gid(i)];
+  if (out.queues.size() < (size_t) link(i)->size())
+    for (int j = 0; j < link(i)->size(); ++j)
+    {
+      if (out.external_local.find(link(i)->target(j)) == out.external_local.end())
+        out.queues[link(i)->target(j)];               // touch the outgoing queue, creating it if necessary
+    }
+}
+
+void
+diy::Master::
+comm_ready(size_t out_queues_limit)
+{
+  while (inflight_size_ < out_queues_limit)
+  {
+    std::pair<int, OutgoingQueuesRecord>  cur;
+    {
+      critical_resource<ReadyList>::accessor ready = ready_.access();
+      if (ready->empty())
+        break;
+      if (!within_budget(ready->front().second))
+      {
+        send_packed_queues();
+        break;
+      }
+      cur.first = ready->front().first;
+      cur.second.queues.swap(ready->front().second.queues);
+      cur.second.external_local.swap(ready->front().second.external_local);
+      cur.second.references.swap(ready->front().second.references);
+      ready->pop_front();
+    }
+
+    send_outgoing_queues(cur.first, cur.second, early_incoming_);
+    flushed_.insert(cur.first);
+  }
+
+  while(nudge());
+
+  receive_queues(early_incoming_);
+}
+
+void
+diy::Master::
+comm_progress(size_t out_queues_limit)
+{
+  if (exchanging_)
+    comm_exchange(to_send_, out_queues_limit_, sending_, early_incoming_);
+  else
+    comm_ready(out_queues_limit);
+}
+
+bool
+diy::Master::
+prefetch_load(void* master_, int i)
+{
+  Master& master = *static_cast<Master*>(master_);
+  if (master.block(i) != 0)
+    return true;
+  {
+    lock_guard<fast_mutex>  lock(master.eviction_mutex_);
+    if (master.in_memory() + master.loading_ >= master.limit())
+      return false;         // no room; the worker will load the block when it gets to it
+    ++master.loading_;
+  }
+  master.load(i);
+
+  lock_guard<fast_mutex>    lock(master.eviction_mutex_);
+  --master.loading_;
+  return true;
+}
+
+int
+diy::Master::
+evict(const std::vector<int>& candidates)
+{
+  lock_guard<fast_mutex>    lock(eviction_mutex_);
+  return eviction_->victim(candidates);
+}
+
+void
+diy::Master::
+used(int i, bool processed)
+{
+  lock_guard<fast_mutex>    lock(eviction_mutex_);
+  if (processed)
+    eviction_->used(i);
+  if (eviction_->shared)
+    evictable_.push_back(i);
+}
+
+void
+diy::Master::
+load_within_limit(int i, int reserve)
+{
+  // the blocks prefetched, but not processed yet, don't count: the reserve is for them
+  while (true)
+  {
+    int victim;
+    {
+      lock_guard<fast_mutex>    lock(eviction_mutex_);
+      if (in_memory() + loading_ - prefetcher_.ready() < limit_ - reserve || evictable_.empty())
+      {
+        ++loading_;
+        break;
+      }
+      victim = eviction_->victim(evictable_);
+      evictable_.erase(std::find(evictable_.begin(), evictable_.end(), victim));
+    }
+    unload(victim);
+  }
+
+  load(i);
+
+  lock_guard<fast_mutex>    lock(eviction_mutex_);
+  --loading_;
+}
+
+int
+diy::Master::LRUEviction::
+victim(const std::vector<int>& candidates)
+{
+  int    best      = candidates[0];
+  size_t best_time = best < (int) last.size() ? last[best] : 0;
+  for (unsigned j = 1; j < candidates.size(); ++j)
+  {
+    int    i    = candidates[j];
+    size_t time = i < (int) last.size() ? last[i] : 0;
+    if (time < best_time)
+    {
+      best      = i;
+      best_time = time;
+    }
+  }
+  return best;
+}
+
+int
+diy::Master::CostAwareEviction::
+victim(const std::vector<int>& candidates)
+{
+  int best = candidates[0];
+  grow(best);
+  for (unsigned j = 1; j < candidates.size(); ++j)
+  {
+    int i = candidates[j];
+    grow(i);
+    if (priority[i] < priority[best])
+      best = i;
+  }
+  baseline = priority[best];
+  return best;
+}
+
+void
+diy::Master::
+merge_early_incoming()
+{
+  for (IncomingQueuesMap::iterator it = early_incoming_.begin(); it != early_incoming_.end(); ++it)
+  {
+    int                    to      = it->first;
+    bool                   in_core = block(lid(to)) != 0;
+    IncomingQueuesRecords& in      = incoming_[to];
+    for (InQueueRecords::iterator cur = it->second.records.begin(); cur != it->second.records.end(); ++cur)
+    {
+      // whether to keep the queue in memory was decided when it arrived, but a foreach
+      // (in between exchange_begin() and exchange_end()) may have moved the block since;
+      // foreach() loads the queues only of the blocks it loads
+      int           from = cur->first;
+      QueueRecord&  qr   = cur->second;
+      if (in_core && qr.external != -1)
+      {
+        storage_->get(qr.external, it->second.queues[from]);
+        qr.external = -1;
+      } else if (!in_core && qr.external == -1 && queue_policy_->unload_incoming(*this, from, to, qr.size))
+        qr.external = storage_->put(it->second.queues[from]);
+      in.records[from] = qr;
+    }
+    for (IncomingQueues::iterator cur = it->second.queues.begin(); cur != it->second.queues.end(); ++cur)
+    {
+      MemoryBuffer& bb = in.queues[cur->first];
+      if (in.viewed)
+      {
+        in.retired.push_back(std::vector<char>());
+        in.retired.back().swap(bb.buffer);
+      }
+      bb.swap(cur->second);
+    }
+  }
+  early_incoming_.clear();
+}
+
+void
+diy::Master::
+clear_incoming()
+{
+  for (IncomingQueuesMap::iterator it = incoming_.begin(); it != incoming_.end(); ++it)
+  {
+    for (InQueueRecords::iterator cur = it->second.records.begin(); cur != it->second.records.end(); ++cur)
+      if (cur->second.external != -1)
+        storage_->destroy(cur->second.external);
+    keep_viewed(it->second);
+  }
+  incoming_.clear();
+}
+
+void
+diy::Master::
+keep_viewed(IncomingQueuesRecords& in)
+{
+  if (!in.viewed)
+    return;
+
+  critical_resource<RetiredBuffers>::accessor viewed = viewed_.access();
+  for (IncomingQueues::iterator it = in.queues.begin(); it != in.queues.end(); ++it)
+  {
+    viewed->push_back(std::vector<char>());
+    viewed->back().swap(it->second.buffer);
+  }
+  viewed->splice(viewed->end(), in.retired);
+}
+
+void
+diy::Master::
+flush_begin(bool gather)
+{
+  // the queues enqueued from now on belong to the next exchange
+  sending_.swap(outgoing_);
+  exchanging_ = true;
+
+  // a foreach before flush_end() may unload the blocks the references point into,
+  // even while the messages that gather them are in flight
+  if (!gather)
+    for (OutgoingQueuesMap::iterator it = sending_.begin(); it != sending_.end(); ++it)
+      materialize(it->second);
 
   // make a list of outgoing queues to send (the ones in memory come first)
-  ToSendList    to_send;
-  for (OutgoingQueuesMap::iterator it = outgoing_.begin(); it != outgoing_.end(); ++it)
+  to_send_.clear();
+  for (OutgoingQueuesMap::iterator it = sending_.begin(); it != sending_.end(); ++it)
   {
     OutgoingQueuesRecord& out = it->second;
     if (out.external == -1)
-        to_send.push_front(it->first);
+        to_send_.push_front(it->first);
     else
-        to_send.push_back(it->first);
+        to_send_.push_back(it->first);
   }
-  //fprintf(stderr, "to_send.size(): %lu\n", to_send.size());
+  //fprintf(stderr, "to_send.size(): %lu\n", to_send_.size());
 
   // XXX: we probably want a cleverer limit than block limit times average number of queues per block
   // XXX: with queues we could easily maintain a specific space limit
-  int out_queues_limit;
   if (limit_ == -1 || size() == 0)
-    out_queues_limit = to_send.size();
+    out_queues_limit_ = to_send_.size();
   else
-    out_queues_limit = std::max((size_t) 1, to_send.size()/size()*limit_);      // average number of queues per block * in-memory block limit
+    out_queues_limit_ = std::max((size_t) 1, to_send_.size()/size()*limit_);      // average number of queues per block * in-memory block limit
+
+  comm_exchange(to_send_, out_queues_limit_, sending_, early_incoming_);
+}
 
-  do
+void
+diy::Master::
+flush_end()
+{
+#ifdef DEBUG
+  time_type start = get_time();
+  unsigned wait = 1;
+#endif
+
+  // sparse: once our own sends have been matched, enter a nonblocking barrier;
+  // once everybody is in it, nothing else is coming
+  bool          barrier_posted = false;
+  mpi::request  barrier;
+
+  while (sparse_ || !inflight_.empty() || !chunked_.empty() || received_ < expected_ || !to_send_.empty())
   {
-    comm_exchange(to_send, out_queues_limit);
+    comm_exchange(to_send_, out_queues_limit_, sending_, early_incoming_);
+
+    if (sparse_)
+    {
+      if (barrier_posted)
+      {
+        if (barrier.test())
+          break;
+      } else if (inflight_.empty() && to_send_.empty() && chunked_.empty())
+      {
+        barrier = exchange_comm_.ibarrier();
+        barrier_posted = true;
+      }
+    }
 
 #ifdef DEBUG
     time_type cur = get_time();
@@ -863,17 +2093,28 @@ flush()
         wait *= 2;
     }
 #endif
-  } while (!inflight_.empty() || received_ < expected_ || !to_send.empty());
+  }
 
-  outgoing_.clear();
+  finish_reassembly(early_incoming_);
+  finish_preposted(early_incoming_);
+
+  sending_.clear();
+  flushed_.clear();
+  exchanging_ = false;
+
+  merge_early_incoming();
 
   //fprintf(stderr, "Done in flush\n");
   //show_incoming_records();
 
   process_collectives();
-  comm_.barrier();
+  if (!sparse_)
+    exchange_comm_.barrier();
 
   received_ = 0;
+  ++epoch_;
+
+  post_receives();
 }
 
 void
@@ -916,19 +2157,60 @@ bool
 diy::Master::
 nudge()
 {
-  bool success = false;
-  for (InFlightList::iterator it = inflight_.begin(); it != inflight_.end(); ++it)
+  if (inflight_.empty() || mpi::test_some(inflight_requests_, completed_, statuses_) == 0)
+    return false;
+
+  for (unsigned i = 0; i < completed_.size(); ++i)
   {
-    mpi::optional<mpi::status> ostatus = it->request.test();
-    if (ostatus)
+    InFlight& m = inflight_[completed_[i]];
+    if (m.chunked)
+      --m.chunked->pending;
+    inflight_bytes_ -= m.message.size();
+    recycle_buffer(m.message);
+  }
+  remove_completed(inflight_, inflight_requests_, completed_);
+  inflight_size_ = inflight_.size();
+
+  // release the large messages that went out completely, keep the pieces of the rest flowing
+  for (ChunkedList::iterator it = chunked_.begin(); it != chunked_.end();)
+  {
+    if (it->sent == it->message.size() && it->pending == 0)
+    {
+      inflight_bytes_ -= it->message.size();
+      recycle_buffer(it->message);
+      chunked_.erase(it++);
+    } else
+      ++it;
+  }
+  send_chunks();
+
+  return true;
+}
+
+template<class Entries>
+void
+diy::Master::
+remove_completed(Entries& entries, Requests& requests, const std::vector<int>& completed)
+{
+  size_t next = 0;
+  size_t c    = 0;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    if (c < completed.size() && completed[c] == (int) i)
+    {
+      ++c;
+      continue;
+    }
+
+    if (next != i)
     {
-      success = true;
-      InFlightList::iterator rm = it;
-      --it;
-      inflight_.erase(rm); --inflight_size_;
+      entries[next].swap(entries[i]);
+      requests[next] = requests[i];
     }
+    ++next;
   }
-  return success;
+  entries.resize(next);
+  requests.resize(next);
 }
 
 void
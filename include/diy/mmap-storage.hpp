@@ -0,0 +1,394 @@
+#ifndef DIY_MMAP_STORAGE_HPP
+#define DIY_MMAP_STORAGE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <cstdlib>      // mkstemp()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "storage.hpp"
+#include "serialization.hpp"
+#include "critical-resource.hpp"
+#include "detail/placement.hpp"
+
+namespace diy
+{
+  namespace detail
+  {
+    // Reads and writes one record in place, `size` bytes at `data`.
+    struct MappedBuffer: public BinaryBuffer
+    {
+                          MappedBuffer(char* data_, size_t size_):
+                            data(data_), size(size_), head(0), tail(0)      {}
+
+      virtual inline void save_binary(const char* x, size_t count)
+      {
+        if (head + count > size)
+          throw std::runtime_error("diy::MmapStorage: the record is larger than the space reserved for it");
+        std::memcpy(data + head, x, count);
+        head += count;
+      }
+
+      virtual inline void load_binary(char* x, size_t count)
+      {
+        if (head + count > size)
+          throw std::runtime_error("diy::MmapStorage: reading past the end of the record");
+        std::memcpy(x, data + head, count);
+        head += count;
+      }
+
+      virtual inline void load_binary_back(char* x, size_t count)
+      {
+        tail += count;
+        std::memcpy(x, data + size - tail, count);
+      }
+
+      char*               data;
+      size_t              size;
+      size_t              head, tail;       // bytes consumed from the front and from the back
+    };
+  }
+
+  //! External storage that keeps records in large memory-mapped files, one per filename template (see FileStorage).
+  //! The files grow in segments of `segment_size` bytes (larger records get a segment of their own), each mapped
+  //! separately; records are written one after another into the current segment, and a segment is reused once
+  //! all of its records have been read back or destroyed. Loading a block reads it straight from the mapping,
+  //! so its pages are brought in as the block deserializes them; the kernel decides which pages stay resident,
+  //! and records spilled recently are usually still in the page cache. Nothing is synced: the files are unlinked
+  //! as soon as they are created and only ever read back by the same process. With several templates, each new
+  //! segment goes to the first directory with room for it (so list the fastest first; see detail::Placement).
+  class MmapStorage: public ExternalStorage
+  {
+    public:
+                    MmapStorage(const std::string& filename_template = "/tmp/DIY.XXXXXX",
+                                size_t segment_size = 1 << 26):
+                      filename_templates_(1, filename_template),
+                      placement_(filename_templates_),
+                      segment_size_(round_up(std::max(segment_size, size_t(1)), page_size()))      {}
+
+                    MmapStorage(const std::vector<std::string>& filename_templates,
+                                size_t segment_size = 1 << 26):
+                      filename_templates_(filename_templates),
+                      placement_(filename_templates_),
+                      segment_size_(round_up(std::max(segment_size, size_t(1)), page_size()))      {}
+
+      inline        ~MmapStorage();
+
+      virtual inline int    put(MemoryBuffer& bb);
+      virtual inline int    put(const void* x, detail::Save save);
+      virtual inline void   get(int i, MemoryBuffer& bb, size_t extra = 0);
+      virtual inline void   get(int i, void* x, detail::Load load);
+      virtual inline void   destroy(int i);
+
+      int           count() const               { return state_.const_access()->count; }
+      size_t        current_size() const        { return state_.const_access()->current_size; }
+      size_t        max_size() const            { return state_.const_access()->max_size; }
+      inline size_t file_size() const;          //!< total size of the mapped segments, including the free ones
+
+    private:
+      struct Record
+      {
+        int             segment;
+        size_t          offset;         // in the segment
+        size_t          size;
+      };
+
+      struct Segment
+      {
+        int             file;
+        off_t           offset;         // in the file
+        size_t          size;
+        char*           data;           // mapping
+        size_t          end;            // of the allocated part
+        int             records;        // live records, and records being written or read
+      };
+
+      struct MappedFile
+      {
+                        MappedFile(): fd(-1), end(0)        {}
+
+        int             fd;
+        off_t           end;
+      };
+
+      struct State
+      {
+                        State(): current(-1), count(0), current_size(0), max_size(0)    {}
+
+        std::map<int, Record>   records;
+        std::vector<Segment>    segments;
+        std::vector<int>        free;           // segments without records
+        std::vector<MappedFile> files;
+        int                     current;        // segment taking new records
+        int                     count;
+        size_t                  current_size, max_size;
+      };
+      typedef       critical_resource<State>        CriticalState;
+
+      inline char*  allocate(size_t size, Record& r);
+      inline void   release(const Record& r);           // also ends the read or write of r
+      inline void   insert(int i, const Record& r);
+      inline char*  extract(int i, Record& r);
+
+      inline void   open_files(State& state) const;
+      inline int    add_segment(State& state, size_t size);     // in the file placement_ chooses
+      inline static void    reserve(int fd, off_t offset, size_t size);        // allocate the disk space, so that writes to the mapping can't fail
+
+      static size_t page_size()                                 { return sysconf(_SC_PAGESIZE); }
+      static size_t round_up(size_t x, size_t alignment)        { return (x + alignment - 1) / alignment * alignment; }
+
+      static const size_t   alignment = 64;             // of the records
+
+    private:
+      std::vector<std::string>      filename_templates_;
+      detail::Placement             placement_;
+      size_t                        segment_size_;
+      CriticalState                 state_;
+  };
+}
+
+diy::MmapStorage::
+~MmapStorage()
+{
+  State& state = *state_.access();
+  for (size_t i = 0; i < state.segments.size(); ++i)
+    munmap(state.segments[i].data, state.segments[i].size);
+  for (size_t i = 0; i < state.files.size(); ++i)
+    close(state.files[i].fd);
+}
+
+int
+diy::MmapStorage::
+put(MemoryBuffer& bb)
+{
+  Record r;
+  char*  data = allocate(bb.size(), r);
+  if (r.size > 0)
+    std::memcpy(data, &bb.buffer[0], r.size);
+  bb.wipe();
+
+  int i = (*state_.access()).count++;
+  insert(i, r);
+  return i;
+}
+
+int
+diy::MmapStorage::
+put(const void* x, detail::Save save)
+{
+  CountingBuffer cb;
+  save(x, cb);
+
+  Record r;
+  char*  data = allocate(cb.count, r);
+  detail::MappedBuffer mb(data, r.size);
+  save(x, mb);
+
+  int i = (*state_.access()).count++;
+  insert(i, r);
+  return i;
+}
+
+void
+diy::MmapStorage::
+get(int i, MemoryBuffer& bb, size_t extra)
+{
+  Record r;
+  char*  data = extract(i, r);
+
+  bb.clear();
+  bb.buffer.reserve(r.size + extra);
+  bb.buffer.insert(bb.buffer.end(), data, data + r.size);
+
+  release(r);
+}
+
+void
+diy::MmapStorage::
+get(int i, void* x, detail::Load load)
+{
+  Record r;
+  char*  data = extract(i, r);
+
+  detail::MappedBuffer mb(data, r.size);
+  load(x, mb);
+
+  release(r);
+}
+
+void
+diy::MmapStorage::
+destroy(int i)
+{
+  Record r;
+  extract(i, r);
+  release(r);
+}
+
+size_t
+diy::MmapStorage::
+file_size() const
+{
+  CriticalState::const_accessor state = state_.const_access();
+  size_t total = 0;
+  for (size_t i = 0; i < state->segments.size(); ++i)
+    total += state->segments[i].size;
+  return total;
+}
+
+char*
+diy::MmapStorage::
+allocate(size_t size, Record& r)
+{
+  CriticalState::accessor state = state_.access();
+  open_files(*state);
+
+  size_t capacity = round_up(size, alignment);
+
+  r.size = size;
+  if (state->current >= 0 && state->segments[state->current].end + capacity <= state->segments[state->current].size)
+    r.segment = state->current;
+  else if (capacity <= segment_size_)
+    r.segment = state->current = add_segment(*state, segment_size_);
+  else
+    r.segment = add_segment(*state, round_up(capacity, page_size()));  // keeps the file end on a page boundary, for the next mmap();
+                                                                        // doesn't become the current segment: it's full
+
+  Segment& s = state->segments[r.segment];
+  r.offset   = s.end;
+  s.end     += capacity;
+  ++s.records;
+  return s.data + r.offset;
+}
+
+void
+diy::MmapStorage::
+insert(int i, const Record& r)
+{
+  CriticalState::accessor state = state_.access();
+  state->records[i] = r;
+
+  state->current_size += r.size;
+  if (state->current_size > state->max_size)
+    state->max_size = state->current_size;
+}
+
+char*
+diy::MmapStorage::
+extract(int i, Record& r)
+{
+  CriticalState::accessor state = state_.access();
+  std::map<int, Record>::iterator it = state->records.find(i);
+  r = it->second;
+  state->records.erase(it);
+  state->current_size -= r.size;
+  return state->segments[r.segment].data + r.offset;
+}
+
+void
+diy::MmapStorage::
+release(const Record& r)
+{
+  CriticalState::accessor state = state_.access();
+  Segment& s = state->segments[r.segment];
+  if (--s.records > 0)
+    return;
+
+  // the segment is empty: start it over, if it's the current one, or set it aside for reuse
+  s.end = 0;
+  if (state->current == r.segment)
+    return;
+#ifdef MADV_REMOVE
+  madvise(s.data, s.size, MADV_REMOVE);         // give the pages and the disk space back, without unmapping
+#endif
+  state->free.push_back(r.segment);
+}
+
+int
+diy::MmapStorage::
+add_segment(State& state, size_t size)
+{
+  // the disk space is taken here, a segment at a time, so that's what placement_ is charged
+  int         file = placement_.choose(size);
+  placement_.finish(file, size);                  // the writes only copy into the mapping: nothing to time
+  MappedFile& f    = state.files[file];
+
+  // reuse the smallest free segment of the file that fits
+  int best = -1;
+  for (size_t j = 0; j < state.free.size(); ++j)
+  {
+    const Segment& s = state.segments[state.free[j]];
+    if (s.file == file && s.size >= size && (best < 0 || s.size < state.segments[state.free[best]].size))
+      best = j;
+  }
+  if (best >= 0)
+  {
+    int i = state.free[best];
+    state.free.erase(state.free.begin() + best);
+    reserve(f.fd, state.segments[i].offset, state.segments[i].size);
+    return i;
+  }
+
+  Segment s;
+  s.file    = file;
+  s.offset  = f.end;
+  s.size    = size;
+  s.end     = 0;
+  s.records = 0;
+  reserve(f.fd, s.offset, size);
+  void* data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, s.offset);
+  if (data == MAP_FAILED)
+    throw std::runtime_error(std::string("diy::MmapStorage: could not map a file: ") + std::strerror(errno));
+  s.data    = static_cast<char*>(data);
+  f.end    += size;
+
+  state.segments.push_back(s);
+  return state.segments.size() - 1;
+}
+
+void
+diy::MmapStorage::
+reserve(int fd, off_t offset, size_t size)
+{
+#ifdef __MACH__
+  int res = 0;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size < offset + (off_t) size && ftruncate(fd, offset + size) != 0)
+    res = errno;
+#else
+  int res = posix_fallocate(fd, offset, size);
+#endif
+  if (res != 0)
+    throw std::runtime_error(std::string("diy::MmapStorage: could not reserve space in a file: ") + std::strerror(res));
+}
+
+void
+diy::MmapStorage::
+open_files(State& state) const
+{
+  if (!state.files.empty())
+    return;
+
+  state.files.resize(filename_templates_.size());
+  for (size_t i = 0; i < filename_templates_.size(); ++i)
+  {
+    std::vector<char>   name(filename_templates_[i].begin(), filename_templates_[i].end());
+    name.push_back(0);
+    MappedFile& f = state.files[i];
+    f.fd = mkstemp(&name[0]);
+    if (f.fd < 0)
+      throw std::runtime_error("diy::MmapStorage: could not create " + filename_templates_[i] + ": " + std::strerror(errno));
+    unlink(&name[0]);           // the space is reclaimed when the file is closed and unmapped
+  }
+}
+
+#endif
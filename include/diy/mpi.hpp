@@ -8,6 +8,8 @@
 #include "mpi/optional.hpp"
 #include "mpi/status.hpp"
 #include "mpi/request.hpp"
+#include "mpi/message.hpp"
+#include "mpi/gather-list.hpp"
 #include "mpi/point-to-point.hpp"
 #include "mpi/communicator.hpp"
 #include "mpi/collectives.hpp"
@@ -32,6 +32,34 @@ namespace mpi
       template<class T>
       request   isend(int dest, int tag, const T& x) const  { return detail::isend<T>()(comm_, dest, tag, x); }
 
+      //! Non-blocking synchronous send: the request completes only once the matching receive has started.
+      template<class T>
+      request   issend(int dest, int tag, const T& x) const { return detail::issend<T>()(comm_, dest, tag, x); }
+
+      //! Non-blocking send of the `count` values starting at `x` (e.g., a piece of a larger buffer).
+      template<class T>
+      request   isend(int dest, int tag, const T* x, int count) const
+      { request r; MPI_Isend((void*) x, count, detail::get_mpi_datatype<T>(), dest, tag, comm_, &r.r); return r; }
+
+      //! Synchronous version of the array `isend()`.
+      template<class T>
+      request   issend(int dest, int tag, const T* x, int count) const
+      { request r; MPI_Issend((void*) x, count, detail::get_mpi_datatype<T>(), dest, tag, comm_, &r.r); return r; }
+
+      //! Non-blocking send of the byte ranges in `g` as one message.
+      //! The ranges (but not `g` itself) must stay valid until the request completes.
+      inline
+      request   isend(int dest, int tag, const gather_list& g) const;
+
+      //! Synchronous version of the `gather_list` `isend()`.
+      inline
+      request   issend(int dest, int tag, const gather_list& g) const;
+
+      //! Non-blocking receive of up to `count` values into `x`.
+      template<class T>
+      request   irecv(int source, int tag, T* x, int count) const
+      { request r; MPI_Irecv(x, count, detail::get_mpi_datatype<T>(), source, tag, comm_, &r.r); return r; }
+
       //! Non-blocking version of `recv()`.
       //! If `T` is an `std::vector<...>`, its size must be big enough to accomodate the sent values.
       template<class T>
@@ -45,9 +73,31 @@ namespace mpi
       optional<status>
                 iprobe(int source, int tag) const;
 
+      //! matched probe: the returned message can be received only with `mrecv()`,
+      //! so another thread probing the same source and tag cannot steal it
+      inline
+      optional<message>
+                improbe(int source, int tag) const;
+
+      //! Receive the message matched by `improbe()`.
+      //! If `T` is an `std::vector<...>`, `mrecv` will resize it to fit exactly the sent number of values.
+      template<class T>
+      status    mrecv(message& m, T& x) const               { return detail::mrecv<T>()(m, x); }
+
       //! barrier
       void      barrier() const                             { MPI_Barrier(comm_); }
 
+      //! nonblocking barrier
+      inline
+      request   ibarrier() const;
+
+      //! duplicate the communicator (collective); the copy must be freed with `free()`
+      inline
+      communicator  duplicate() const;
+
+      //! free a communicator obtained from `duplicate()`
+      void      free()                                      { MPI_Comm_free(&comm_); }
+
                 operator MPI_Comm() const                   { return comm_; }
 
     private:
@@ -70,3 +120,54 @@ iprobe(int source, int tag) const
   return optional<status>();
 }
 
+diy::mpi::optional<diy::mpi::message>
+diy::mpi::communicator::
+improbe(int source, int tag) const
+{
+  message m;
+  int flag;
+  MPI_Improbe(source, tag, comm_, &flag, &m.m, &m.s.s);
+  if (flag)
+    return m;
+  return optional<message>();
+}
+
+diy::mpi::request
+diy::mpi::communicator::
+isend(int dest, int tag, const gather_list& g) const
+{
+  request r;
+  MPI_Datatype type = g.datatype();
+  MPI_Isend(MPI_BOTTOM, 1, type, dest, tag, comm_, &r.r);
+  MPI_Type_free(&type);         // freed once the send is done with it
+  return r;
+}
+
+diy::mpi::request
+diy::mpi::communicator::
+issend(int dest, int tag, const gather_list& g) const
+{
+  request r;
+  MPI_Datatype type = g.datatype();
+  MPI_Issend(MPI_BOTTOM, 1, type, dest, tag, comm_, &r.r);
+  MPI_Type_free(&type);
+  return r;
+}
+
+diy::mpi::communicator
+diy::mpi::communicator::
+duplicate() const
+{
+  MPI_Comm comm;
+  MPI_Comm_dup(comm_, &comm);
+  return communicator(comm);
+}
+
+diy::mpi::request
+diy::mpi::communicator::
+ibarrier() const
+{
+  request r;
+  MPI_Ibarrier(comm_, &r.r);
+  return r;
+}
@@ -0,0 +1,65 @@
+#ifndef DIY_MPI_GATHER_LIST_HPP
+#define DIY_MPI_GATHER_LIST_HPP
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+namespace diy
+{
+namespace mpi
+{
+  //! \ingroup MPI
+  //! A list of byte ranges scattered through memory, sent as one message without packing them first
+  //! (see `communicator::isend(int, int, const gather_list&)`); the receiver sees the ranges back to back.
+  class gather_list
+  {
+    public:
+                gather_list(): size_(0)                     {}
+
+      void      add(const void* address, size_t size)
+      {
+        if (size == 0) return;
+        MPI_Aint a;
+        MPI_Get_address(const_cast<void*>(address), &a);
+        size_ += size;
+        while (size > 0)        // MPI takes the lengths as ints: split the larger ranges
+        {
+          size_t length = std::min(size, size_t(INT_MAX));
+          displacements_.push_back(a);
+          lengths_.push_back(int(length));
+          a    += MPI_Aint(length);
+          size -= length;
+        }
+      }
+
+      //! total number of bytes
+      size_t    size() const                                { return size_; }
+
+      //! hindexed datatype describing the ranges, relative to `MPI_BOTTOM`; the caller frees it
+      inline
+      MPI_Datatype
+                datatype() const;
+
+    private:
+      std::vector<MPI_Aint>     displacements_;
+      std::vector<int>          lengths_;
+      size_t                    size_;
+  };
+}
+}
+
+MPI_Datatype
+diy::mpi::gather_list::
+datatype() const
+{
+  MPI_Datatype type;
+  MPI_Type_create_hindexed(lengths_.size(),
+                           lengths_.empty() ? 0 : const_cast<int*>(&lengths_[0]),
+                           displacements_.empty() ? 0 : const_cast<MPI_Aint*>(&displacements_[0]),
+                           MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+#endif
@@ -0,0 +1,19 @@
+namespace diy
+{
+namespace mpi
+{
+  //! A message matched by `communicator::improbe()`; nobody else can receive it,
+  //! it has to be received with `communicator::mrecv()`.
+  struct message
+  {
+    int             source() const          { return s.source(); }
+    int             tag() const             { return s.tag(); }
+
+    template<class T>
+    int             count() const           { return s.count<T>(); }
+
+    MPI_Message     m;
+    status          s;
+  };
+}
+}
@@ -53,6 +53,33 @@ namespace detail
     }
   };
 
+  // mrecv
+  template< class T, class is_mpi_datatype_ = typename is_mpi_datatype<T>::type >
+  struct mrecv;
+
+  template<class T>
+  struct mrecv<T, true_type>
+  {
+    status operator()(message& m, T& x) const
+    {
+      status s;
+      MPI_Mrecv(&x, 1, get_mpi_datatype<T>(), &m.m, &s.s);
+      return s;
+    }
+  };
+
+  template<class U>
+  struct mrecv<std::vector<U>, true_type>
+  {
+    status operator()(message& m, std::vector<U>& x) const
+    {
+      status s;
+      x.resize(m.count<U>());
+      MPI_Mrecv(x.empty() ? 0 : &x[0], x.size(), get_mpi_datatype<U>(), &m.m, &s.s);     // empty messages still need to be received
+      return s;
+    }
+  };
+
   // isend
   template< class T, class is_mpi_datatype_ = typename is_mpi_datatype<T>::type >
   struct isend;
@@ -72,6 +99,25 @@ namespace detail
     }
   };
 
+  // issend
+  template< class T, class is_mpi_datatype_ = typename is_mpi_datatype<T>::type >
+  struct issend;
+
+  template<class T>
+  struct issend<T, true_type>
+  {
+    request operator()(MPI_Comm comm, int dest, int tag, const T& x) const
+    {
+      request r;
+      typedef       mpi_datatype<T>     Datatype;
+      MPI_Issend((void*) Datatype::address(x),
+                 Datatype::count(x),
+                 Datatype::datatype(),
+                 dest, tag, comm, &r.r);
+      return r;
+    }
+  };
+
   // irecv
   template< class T, class is_mpi_datatype_ = typename is_mpi_datatype<T>::type >
   struct irecv;
@@ -1,3 +1,6 @@
+#include <vector>
+#include <algorithm>
+
 namespace diy
 {
 namespace mpi
@@ -11,6 +14,29 @@ namespace mpi
 
     MPI_Request         r;
   };
+
+  // request and status wrap a single MPI handle, so vectors of them can be passed to MPI as arrays
+
+  //! Wait for all the `requests` to complete; their statuses are stored in `statuses`.
+  inline void           wait_all(std::vector<request>& requests, std::vector<status>& statuses);
+
+  //! Wait for all the `requests` to complete.
+  inline void           wait_all(std::vector<request>& requests);
+
+  //! Test the `requests` (with `MPI_Testsome`); the indices of the completed ones are stored
+  //! in increasing order in `completed`, their statuses in `statuses`.
+  //! Returns the number of completed requests.
+  inline int            test_some(std::vector<request>& requests, std::vector<int>& completed, std::vector<status>& statuses);
+
+  //! Same as `test_some()`, but blocks until at least one request completes (with `MPI_Waitsome`).
+  inline int            wait_some(std::vector<request>& requests, std::vector<int>& completed, std::vector<status>& statuses);
+
+  namespace detail
+  {
+    // MPI doesn't promise any particular order of the completed indices
+    inline void         sort_completed(std::vector<int>& completed, std::vector<status>& statuses);
+    inline bool         by_index(const std::pair<int, status>& x, const std::pair<int, status>& y)  { return x.first < y.first; }
+  }
 }
 }
 
@@ -24,3 +50,80 @@ diy::mpi::request::test()
     return s;
   return optional<status>();
 }
+
+void
+diy::mpi::
+wait_all(std::vector<request>& requests, std::vector<status>& statuses)
+{
+  statuses.resize(requests.size());
+  if (requests.empty())
+    return;
+  MPI_Waitall(requests.size(), &requests[0].r, &statuses[0].s);
+}
+
+void
+diy::mpi::
+wait_all(std::vector<request>& requests)
+{
+  if (requests.empty())
+    return;
+  MPI_Waitall(requests.size(), &requests[0].r, MPI_STATUSES_IGNORE);
+}
+
+void
+diy::mpi::detail::
+sort_completed(std::vector<int>& completed, std::vector<status>& statuses)
+{
+  for (size_t i = 1; i < completed.size(); ++i)
+    if (completed[i-1] > completed[i])
+    {
+      std::vector< std::pair<int, status> >     sorted;
+      for (size_t j = 0; j < completed.size(); ++j)
+        sorted.push_back(std::make_pair(completed[j], statuses[j]));
+      std::sort(sorted.begin(), sorted.end(), by_index);
+      for (size_t j = 0; j < completed.size(); ++j)
+      {
+        completed[j] = sorted[j].first;
+        statuses[j]  = sorted[j].second;
+      }
+      return;
+    }
+}
+
+int
+diy::mpi::
+test_some(std::vector<request>& requests, std::vector<int>& completed, std::vector<status>& statuses)
+{
+  completed.resize(requests.size());
+  statuses.resize(requests.size());
+
+  int count = 0;
+  if (!requests.empty())
+    MPI_Testsome(requests.size(), &requests[0].r, &count, &completed[0], &statuses[0].s);
+  if (count == MPI_UNDEFINED)       // no active requests
+    count = 0;
+
+  completed.resize(count);
+  statuses.resize(count);
+  detail::sort_completed(completed, statuses);
+  return count;
+}
+
+int
+diy::mpi::
+wait_some(std::vector<request>& requests, std::vector<int>& completed, std::vector<status>& statuses)
+{
+  completed.resize(requests.size());
+  statuses.resize(requests.size());
+
+  int count = 0;
+  if (!requests.empty())
+    MPI_Waitsome(requests.size(), &requests[0].r, &count, &completed[0], &statuses[0].s);
+  if (count == MPI_UNDEFINED)
+    count = 0;
+
+  completed.resize(count);
+  statuses.resize(count);
+  detail::sort_completed(completed, statuses);
+  return count;
+}
@@ -32,6 +32,7 @@ namespace diy
   namespace this_thread
   {
       inline unsigned long int  get_id()    { return 0; }
+      inline void               yield()     {}
   }
 }
 
@@ -14,6 +14,8 @@ namespace diy
                           master_(master),
                           incoming_(&master->incoming(gid)),
                           outgoing_(&master->outgoing(gid)),
+                          references_(&master->outgoing_references(gid)),
+                          in_records_(&master->incoming_records(gid)),
                           collectives_(&master->collectives(gid))       {}
 
     int                 gid() const                                     { return gid_; }
@@ -24,7 +26,16 @@ namespace diy
                                 const T&        x,                                      //!< data (eg. STL vector)
                                 void (*save)(BinaryBuffer&, const T&) = &::diy::save<T> //!< optional serialization function
                                ) const
-    { OutgoingQueues& out = *outgoing_; save(out[to], x); }
+    {
+        MemoryBuffer& bb = (*outgoing_)[to];
+        if (save == (void (*)(BinaryBuffer&, const T&)) &::diy::save<T>)
+        {
+            bb.reserve_more(detail::quick_size<T>::size(x));
+            ::diy::save(bb, x);     // statically dispatched
+        }
+        else
+            save(bb, x);
+    }
 
     //! Enqueue an array of data whose size is given explicitly
     template<class T>
@@ -34,6 +45,39 @@ namespace diy
                                 void (*save)(BinaryBuffer&, const T&) = &::diy::save<T> //!< optional serialization function
                                ) const;
 
+    //! Enqueue a reference to an array instead of a copy: the receiver gets the same data as from
+    //! `enqueue(to, x, n)`, but `x` must stay valid and unchanged until the `exchange()` that sends it returns.
+    //! Types that are not saved as plain bytes (see `diy::save()` for arrays) are copied as usual, and so is
+    //! everything `exchange_begin()` or `foreach_exchange()` sends with a memory limit (the blocks may be
+    //! unloaded while the messages are in flight).
+    template<class T>
+    void                enqueue_ref(const BlockID&  to,                                 //!< target block (gid,proc)
+                                    const T*        x,                                  //!< pointer to the data
+                                    size_t          n                                   //!< size in data elements
+                                   ) const;
+
+    //! Enqueue float or double values with a bounded error: every value that `dequeue_lossy()` returns
+    //! is within `tolerance` of the original. Smooth fields shrink severalfold (see `diy::save_quantized()`).
+    template<class T>
+    void                enqueue_lossy(const BlockID&  to,                               //!< target block (gid,proc)
+                                      const T*        x,                                //!< pointer to the data
+                                      size_t          n,                                //!< size in data elements
+                                      double          tolerance                         //!< maximum absolute error
+                                     ) const
+    { save_quantized(outgoing(to), x, n, tolerance); }
+
+    template<class T>
+    void                enqueue_lossy(const BlockID& to, const std::vector<T>& v, double tolerance) const
+    { save_quantized(outgoing(to), v, tolerance); }
+
+    //! Dequeue `n` values enqueued with `enqueue_lossy()`.
+    template<class T>
+    void                dequeue_lossy(int from, T* x, size_t n) const                   { load_quantized(incoming(from), x, n); }
+
+    //! Dequeue a vector enqueued with `enqueue_lossy()`.
+    template<class T>
+    void                dequeue_lossy(int from, std::vector<T>& v) const                { load_quantized(incoming(from), v); }
+
     //! Dequeue data whose size can be determined automatically.
     //! Diy will allocate the receive buffer.
     template<class T>
@@ -41,7 +85,13 @@ namespace diy
                                 T&              x,                                      //!< data (eg. STL vector)
                                 void (*load)(BinaryBuffer&, T&) = &::diy::load<T>       //!< optional serialization function
                                ) const
-    { IncomingQueues& in  = *incoming_; load(in[from], x); }
+    {
+        MemoryBuffer& bb = (*incoming_)[from];
+        if (load == (void (*)(BinaryBuffer&, T&)) &::diy::load<T>)
+            ::diy::load(bb, x);     // statically dispatched
+        else
+            load(bb, x);
+    }
 
     //! Dequeue an array of data whose size is given explicitly.
     //! The user needs to allocate the receive buffer.
@@ -52,6 +102,21 @@ namespace diy
                                 void (*load)(BinaryBuffer&, T&) = &::diy::load<T>       //!< optional serialization function
                                ) const;
 
+    //! Dequeue an array of `n` values without copying them: the returned view points directly into
+    //! the incoming queue and stays valid until the next `foreach()` starts (the queues it points into
+    //! stay in memory until then, even if the block is moved out of core). `T` must be saved as plain
+    //! bytes (see `diy::save()` for arrays). If the data is not suitably aligned for `T`, the rest of the queue
+    //! is copied once into an aligned buffer; views handed out earlier remain valid.
+    template<class T>
+    ArrayView<T>        dequeue_view(int             from,                              //!< target block gid
+                                     size_t          n                                  //!< size in data elements
+                                    ) const;
+
+    //! Dequeue a view of the elements of a `std::vector<T>` enqueued with `enqueue(to, v)`.
+    template<class T>
+    ArrayView<T>        dequeue_view(int from) const
+    { size_t n; dequeue(from, n); return dequeue_view<T>(from, n); }
+
     template<class T>
     EnqueueIterator<T>  enqueuer(const T& x,
                                  void (*save)(BinaryBuffer&, const T&) = &::diy::save<T>) const
@@ -83,6 +148,8 @@ namespace diy
       Master*           master_;
       IncomingQueues*   incoming_;
       OutgoingQueues*   outgoing_;
+      OutgoingReferences*   references_;
+      IncomingQueuesRecords*    in_records_;
       CollectivesList*  collectives_;
   };
 
@@ -178,14 +245,36 @@ enqueue(const BlockID& to, const T* x, size_t n,
         void (*save)(BinaryBuffer&, const T&)) const
 {
     OutgoingQueues& out = *outgoing_;
-    BinaryBuffer&   bb  = out[to];
+    MemoryBuffer&   bb  = out[to];
     if (save == (void (*)(BinaryBuffer&, const T&)) &::diy::save<T>)
+    {
+        if (detail::is_bitwise<T>::value)
+            bb.reserve_more(sizeof(T)*n);
         diy::save(bb, x, n);       // optimized for unspecialized types
+    }
     else
         for (size_t i = 0; i < n; ++i)
             save(bb, x[i]);
 }
 
+template<class T>
+void
+diy::Master::Proxy::
+enqueue_ref(const BlockID& to, const T* x, size_t n) const
+{
+    if (!detail::is_bitwise<T>::value)
+    {
+        enqueue(to, x, n);
+        return;
+    }
+
+    Reference r;
+    r.offset = (*outgoing_)[to].position;        // creates the queue, if necessary
+    r.data   = (const char*) x;
+    r.size   = sizeof(T)*n;
+    (*references_)[to].push_back(r);
+}
+
 template<class T>
 void
 diy::Master::Proxy::
@@ -193,7 +282,7 @@ dequeue(int from, T* x, size_t n,
         void (*load)(BinaryBuffer&, T&)) const
 {
     IncomingQueues& in = *incoming_;
-    BinaryBuffer&   bb = in[from];
+    MemoryBuffer&   bb = in[from];
     if (load == (void (*)(BinaryBuffer&, T&)) &::diy::load<T>)
         diy::load(bb, x, n);       // optimized for unspecialized types
     else
@@ -201,5 +290,35 @@ dequeue(int from, T* x, size_t n,
             load(bb, x[i]);
 }
 
+template<class T>
+diy::ArrayView<T>
+diy::Master::Proxy::
+dequeue_view(int from, size_t n) const
+{
+    typedef char        requires_bitwise_serialization[detail::is_bitwise<T>::value ? 1 : -1];
+    (void) sizeof(requires_bitwise_serialization);
+
+    if (n == 0)
+        return ArrayView<T>();
+
+    MemoryBuffer& bb = (*incoming_)[from];
+    if (bb.position > bb.buffer.size() || n > (bb.buffer.size() - bb.position) / sizeof(T))
+        throw std::runtime_error("diy: dequeue_view() past the end of the incoming queue");
+    in_records_->viewed = true;
+
+    if (reinterpret_cast<size_t>(&bb.buffer[bb.position]) % detail::alignment_of<T>::value != 0)
+    {
+        // a fresh vector is aligned for any T; keep the old one alive for the views already handed out
+        std::vector<char> rest(bb.buffer.begin() + bb.position, bb.buffer.end());
+        in_records_->retired.push_back(std::vector<char>());
+        in_records_->retired.back().swap(bb.buffer);
+        bb.buffer.swap(rest);
+        bb.position = 0;
+    }
+
+    const T* data = reinterpret_cast<const T*>(&bb.buffer[bb.position]);
+    bb.position += sizeof(T)*n;
+    return ArrayView<T>(data, n);
+}
 
 #endif
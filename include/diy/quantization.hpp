@@ -0,0 +1,223 @@
+#ifndef DIY_QUANTIZATION_HPP
+#define DIY_QUANTIZATION_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "serialization.hpp"
+#include "varint.hpp"
+
+namespace diy
+{
+  //!\addtogroup Serialization
+  //!@{
+
+  // Error-bounded lossy encoding of float and double arrays, for exchanges (e.g., for visualization
+  // or analysis) that can tolerate a bounded error. Each value is quantized to the nearest multiple of
+  // 2*tolerance; the multiple is predicted by linear extrapolation from the previous two, and the prediction
+  // errors of every 64 values are packed with as many bits as the largest of them needs, so a smooth field
+  // takes a few bits per value. Values that can't be quantized within the tolerance (including infinities
+  // and NaNs) are saved exactly; so is everything, if the tolerance is 0.
+  // Proxy::enqueue_lossy() and Proxy::dequeue_lossy() call these functions.
+
+  //! Saves `n` values (and their count), so that each loaded value is within `tolerance` of the original.
+  template<class T>
+  void                  save_quantized(BinaryBuffer& bb, const T* x, size_t n, double tolerance);
+
+  template<class T>
+  void                  save_quantized(BinaryBuffer& bb, const std::vector<T>& v, double tolerance)
+  { save_quantized(bb, v.empty() ? 0 : &v[0], v.size(), tolerance); }
+
+  //! Loads exactly `n` values saved by save_quantized().
+  template<class T>
+  void                  load_quantized(BinaryBuffer& bb, T* x, size_t n);
+
+  template<class T>
+  void                  load_quantized(BinaryBuffer& bb, std::vector<T>& v);
+
+  //@}
+
+  namespace detail
+  {
+    template<class T>   struct is_float                 { static const bool value = false; };
+    template<>          struct is_float<float>          { static const bool value = true;  };
+    template<>          struct is_float<double>         { static const bool value = true;  };
+
+    // Layout: count (varint), step (double), then for every block of (up to) 64 values: the bit width (a byte),
+    // the codes packed with that width, and the values saved exactly, in order. A code is zigzag(e) + 1,
+    // where e is the error of the prediction of the multiple of the step; 0 marks a value saved exactly.
+    struct Quantizer
+    {
+      static const size_t   block       = 64;
+      static const size_t   max_bytes   = block * 32 / 8;
+
+                            Quantizer(double step_):
+                              step(step_), inv_step(step_ > 0 ? 1/step_ : 0), k1(0), k2(0)     {}
+
+      // the multiple of the step nearest to x, if it's representable, 0 otherwise; the encoder and
+      // the decoder must compute the same multiples (and values) from the same inputs
+      long long             quantize(double x) const
+      {
+        double d = x * inv_step;
+        if (!(std::fabs(d) < 1099511627776.))   // 2^40
+          return 0;
+        return (long long) (d < 0 ? d - .5 : d + .5);
+      }
+
+      template<class T>
+      T                     value(long long k) const                { return T(double(k) * step); }
+
+      long long             prediction() const                      { return 2*k1 - k2; }
+      void                  update(long long k)                     { k2 = k1; k1 = k; }
+
+      static bool           fits(long long e)                       { return e > -1073741824LL && e < 1073741824LL; }   // 2^30, so that codes fit in 32 bits
+
+      double                step, inv_step;
+      long long             k1, k2;         // the last two multiples
+    };
+
+    template<class T>
+    void                load_quantized(VarintReader& in, T* x, size_t n, double step)
+    {
+      Quantizer         quantizer(step);
+      unsigned char     packed[Quantizer::max_bytes];
+      for (size_t b = 0; b < n; b += Quantizer::block)
+      {
+        size_t          m = std::min(size_t(Quantizer::block), n - b);
+        unsigned char   width;
+        in.get_bytes(&width, 1);
+        if (width > 32)
+          throw std::runtime_error("diy::load_quantized(): corrupted data");
+        in.get_bytes(packed, (m * width + 7) / 8);
+
+        varint_t        acc  = 0;
+        unsigned        bits = 0;
+        size_t          pos  = 0;
+        varint_t        mask = (varint_t(1) << width) - 1;
+        for (size_t j = 0; j < m; ++j)
+        {
+          while (bits < width)
+          {
+            acc  |= varint_t(packed[pos++]) << bits;
+            bits += 8;
+          }
+          varint_t code = acc & mask;
+          acc  >>= width;
+          bits  -= width;
+
+          T&        y = x[b + j];
+          long long k;
+          if (code == 0)
+          {
+            in.get_bytes(&y, sizeof(T));
+            k = quantizer.quantize(double(y));
+          } else
+          {
+            k = quantizer.prediction() + unzigzag<long long>(code - 1);
+            y = quantizer.value<T>(k);
+          }
+          quantizer.update(k);
+        }
+      }
+    }
+  }
+}
+
+template<class T>
+void
+diy::
+save_quantized(BinaryBuffer& bb, const T* x, size_t n, double tolerance)
+{
+  typedef char          requires_float_or_double[detail::is_float<T>::value ? 1 : -1];
+  (void) sizeof(requires_float_or_double);
+
+  using detail::Quantizer;
+  using detail::varint_t;
+
+  double step = tolerance > 0 ? 2*tolerance : 0;
+
+  detail::VarintWriter  out(bb);
+  out.put(n);
+  out.put_bytes(&step, sizeof(double));
+
+  Quantizer             quantizer(step);
+  varint_t              codes[Quantizer::block];
+  T                     exact[Quantizer::block];
+  unsigned char         packed[Quantizer::max_bytes];
+  for (size_t b = 0; b < n; b += Quantizer::block)
+  {
+    size_t      m       = std::min(size_t(Quantizer::block), n - b);
+    size_t      nexact  = 0;
+    varint_t    all     = 0;
+    for (size_t j = 0; j < m; ++j)
+    {
+      const T&  y = x[b + j];
+      long long k = quantizer.quantize(double(y));
+      long long e = k - quantizer.prediction();
+      if (step > 0 && Quantizer::fits(e) &&
+          std::fabs(double(quantizer.value<T>(k)) - double(y)) <= tolerance)
+        codes[j] = detail::zigzag(e) + 1;
+      else
+      {
+        codes[j] = 0;
+        exact[nexact++] = y;
+      }
+      all |= codes[j];
+      quantizer.update(k);
+    }
+
+    unsigned char width = 0;
+    while (all >> width)
+      ++width;
+
+    varint_t    acc  = 0;
+    unsigned    bits = 0;
+    size_t      pos  = 0;
+    for (size_t j = 0; j < m; ++j)
+    {
+      acc  |= codes[j] << bits;
+      bits += width;
+      while (bits >= 8)
+      {
+        packed[pos++] = (unsigned char) acc;
+        acc  >>= 8;
+        bits  -= 8;
+      }
+    }
+    if (bits)
+      packed[pos++] = (unsigned char) acc;
+
+    out.put_bytes(&width, 1);
+    out.put_bytes(packed, pos);
+    out.put_bytes(exact, nexact * sizeof(T));
+  }
+}
+
+template<class T>
+void
+diy::
+load_quantized(BinaryBuffer& bb, T* x, size_t n)
+{
+  detail::VarintReader  in(bb);
+  if (in.get() != n)
+    throw std::runtime_error("diy::load_quantized(): the number of values doesn't match");
+  double step;
+  in.get_bytes(&step, sizeof(double));
+  detail::load_quantized(in, x, n, step);
+}
+
+template<class T>
+void
+diy::
+load_quantized(BinaryBuffer& bb, std::vector<T>& v)
+{
+  detail::VarintReader  in(bb);
+  v.resize(in.get_size(detail::Quantizer::block, sizeof(double)));     // the step, then at least a byte (the width) for every block
+  double step;
+  in.get_bytes(&step, sizeof(double));
+  detail::load_quantized(in, v.empty() ? 0 : &v[0], v.size(), step);
+}
+
+#endif
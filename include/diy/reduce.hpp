@@ -93,6 +93,10 @@ void reduce(Master&                    master,
 {
   int original_expected = master.expected();
 
+  // partners count on a queue from each other, so don't skip the empty ones
+  bool original_sparse = master.sparse();
+  master.set_sparse(false);
+
   unsigned round;
   for (round = 0; round < partners.rounds(); ++round)
   {
@@ -120,6 +124,7 @@ void reduce(Master&                    master,
                  detail::SkipInactiveOr<Partners,Skip>(round, partners, skip));
 
   master.set_expected(original_expected);
+  master.set_sparse(original_sparse);
 }
 
 template<class Reduce, class Partners>
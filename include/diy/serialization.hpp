@@ -2,6 +2,7 @@
 #define DIY_SERIALIZATION_HPP
 
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -9,7 +10,9 @@
 
 #if __cplusplus > 199711L           // C++11
 #include <tuple>
+#include <array>
 #include <unordered_map>
+#include <type_traits>
 #endif
 
 namespace diy
@@ -22,6 +25,8 @@ namespace diy
     virtual void        load_binary_back(char* x, size_t count)     =0;   //!< copy `count` bytes into `x` from the back of the buffer
   };
 
+  //! A serialization buffer in memory. The serialization code binds its calls to `save_binary()`
+  //! and `load_binary()` statically, so a derived class must not override them. \ingroup Serialization
   struct MemoryBuffer: public BinaryBuffer
   {
                         MemoryBuffer(size_t position_ = 0):
@@ -38,6 +43,7 @@ namespace diy
     bool                empty() const                               { return buffer.empty(); }
     size_t              size() const                                { return buffer.size(); }
     void                reserve(size_t s)                           { buffer.reserve(s); }
+    inline void         reserve_more(size_t count);                 //!< make room for `count` more bytes at the current position
                         operator bool() const                       { return position < buffer.size(); }
 
     //! multiplier used for the geometric growth of the container
@@ -58,9 +64,34 @@ namespace diy
     std::vector<char>   buffer;
   };
 
+  //! A buffer that only counts the bytes saved into it; used to find out how large a buffer
+  //! to reserve before serializing into it (see `diy::serialized_size()`). \ingroup Serialization
+  struct CountingBuffer: public BinaryBuffer
+  {
+                        CountingBuffer(): count(0)                  {}
+
+    virtual void        save_binary(const char*, size_t count_)     { count += count_; }
+    virtual void        load_binary(char*, size_t)                  {}  // nothing to load
+    virtual void        load_binary_back(char*, size_t)             {}
+
+    size_t              count;
+  };
+
   namespace detail
   {
     struct Default {};
+
+    // Raw copies for the serialization code, which is written against the buffer type: the generic
+    // version goes through the virtual interface; for a MemoryBuffer the call is bound statically.
+    template<class Buffer>
+    void                save_binary(Buffer& bb, const char* x, size_t count)    { bb.save_binary(x, count); }
+    template<class Buffer>
+    void                load_binary(Buffer& bb, char* x, size_t count)          { bb.load_binary(x, count); }
+
+    inline void         save_binary(MemoryBuffer& bb, const char* x, size_t count)  { bb.MemoryBuffer::save_binary(x, count); }
+    inline void         load_binary(MemoryBuffer& bb, char* x, size_t count)        { bb.MemoryBuffer::load_binary(x, count); }
+
+    inline void         save_binary(CountingBuffer& bb, const char*, size_t count)  { bb.count += count; }
   }
 
   //!\addtogroup Serialization
@@ -75,17 +106,22 @@ namespace diy
    * `sizeof(T)` bytes from `&x` to or from `bb` via
    * its `diy::BinaryBuffer::save_binary()` and `diy::BinaryBuffer::load_binary()`
    * functions.  This works out perfectly for plain old data (e.g., simple structs).
+   * The default version and the specializations provided by DIY are templated on the
+   * buffer type, so that saving to a `diy::MemoryBuffer` involves no virtual calls;
+   * specializations written against `diy::BinaryBuffer&` work with any buffer.
    * To save a more complicated type, one has to specialize
    * `diy::Serialization<T>` for that type. Specializations are already provided for
-   * `std::vector<T>`, `std::map<K,V>`, and `std::pair<T,U>`.
+   * `std::vector<T>`, `std::map<K,V>`, `std::pair<T,U>`, and (in C++11) `std::tuple` and `std::array`.
    * As a result one can quickly add a specialization of one's own
    *
    */
   template<class T>
   struct Serialization: public detail::Default
   {
-    static void         save(BinaryBuffer& bb, const T& x)          { bb.save_binary((const char*)  &x, sizeof(T)); }
-    static void         load(BinaryBuffer& bb, T& x)                { bb.load_binary((char*)        &x, sizeof(T)); }
+    template<class Buffer>
+    static void         save(Buffer& bb, const T& x)                { detail::save_binary(bb, (const char*) &x, sizeof(T)); }
+    template<class Buffer>
+    static void         load(Buffer& bb, T& x)                      { detail::load_binary(bb, (char*)       &x, sizeof(T)); }
   };
 
   //! Saves `x` to `bb` by calling `diy::Serialization<T>::save(bb,x)`.
@@ -96,16 +132,35 @@ namespace diy
   template<class T>
   void                  load(BinaryBuffer& bb, T& x)                { Serialization<T>::load(bb, x); }
 
-  //! Optimization for arrays. If `diy::Serialization` is not specialized for `T`,
-  //! the array will be copied all at once. Otherwise, it's copied element by element.
+  //! Same as above, but the specializations that take the buffer type as a template parameter
+  //! (the default one and those provided by DIY) copy into `bb` without virtual calls.
+  template<class T>
+  void                  save(MemoryBuffer& bb, const T& x)          { Serialization<T>::save(bb, x); }
+
+  template<class T>
+  void                  load(MemoryBuffer& bb, T& x)                { Serialization<T>::load(bb, x); }
+
+  //! Optimization for arrays. If `diy::Serialization` is not specialized for `T` and `T` is trivially
+  //! copyable (or `T` is a pair or `std::array` of such types), the array will be copied all at once.
+  //! Otherwise, it's copied element by element.
   template<class T>
   void                  save(BinaryBuffer& bb, const T* x, size_t n);
 
-  //! Optimization for arrays. If `diy::Serialization` is not specialized for `T`,
+  //! Optimization for arrays. Under the same conditions as `save()` above,
   //! the array will be filled all at once. Otherwise, it's filled element by element.
   template<class T>
   void                  load(BinaryBuffer& bb, T* x, size_t n);
 
+  template<class T>
+  void                  save(MemoryBuffer& bb, const T* x, size_t n);
+
+  template<class T>
+  void                  load(MemoryBuffer& bb, T* x, size_t n);
+
+  //! Number of bytes `diy::save(bb, x)` writes; the data is traversed, but not copied.
+  template<class T>
+  size_t                serialized_size(const T& x)                 { CountingBuffer cb; Serialization<T>::save(cb, x); return cb.count; }
+
   //! Supports only binary data copying (meant for simple footers).
   template<class T>
   void                  load_back(BinaryBuffer& bb, T& x)           { bb.load_binary_back((char*) &x, sizeof(T)); }
@@ -126,40 +181,136 @@ namespace diy
 
         enum { value = (sizeof(test((T*) 0)) == sizeof(yes)) };
     };
+
+    // Whether an array of T can be saved and loaded with a single copy of its bytes: T uses the default
+    // serialization and is trivially copyable, or it's a std::pair or std::array of such types (for a pair,
+    // only if it has no padding, so that no stray bytes are copied along). Not a std::tuple: implementations
+    // may lay out its elements in reverse, so its bytes wouldn't match saving the elements in order.
+    template<typename T>
+    struct is_bitwise
+    {
+#if __cplusplus > 199711L           // C++11
+        enum { value = is_default< Serialization<T> >::value && std::is_trivially_copyable<T>::value };
+#else
+        enum { value = is_default< Serialization<T> >::value };
+#endif
+    };
+
+    template<class X, class Y>
+    struct is_bitwise< std::pair<X,Y> >
+    {
+        enum { value = is_bitwise<X>::value && is_bitwise<Y>::value && sizeof(std::pair<X,Y>) == sizeof(X) + sizeof(Y) };
+    };
+
+#if __cplusplus > 199711L           // C++11
+    template<class U, std::size_t N>
+    struct is_bitwise< std::array<U,N> >
+    {
+        enum { value = is_bitwise<U>::value };
+    };
+#endif
   }
 
-  template<class T>
-  void                  save(BinaryBuffer& bb, const T* x, size_t n)
+  namespace detail
   {
-    if (!detail::is_default< Serialization<T> >::value)
-      for (size_t i = 0; i < n; ++i)
-        diy::save(bb, x[i]);
-    else        // if Serialization is not specialized for U, just save the binary data
-      bb.save_binary((const char*) &x[0], sizeof(T)*n);
+    template<class Buffer, class T>
+    void                save_array(Buffer& bb, const T* x, size_t n)
+    {
+      if (!is_bitwise<T>::value)
+        for (size_t i = 0; i < n; ++i)
+          Serialization<T>::save(bb, x[i]);
+      else      // if the elements are plain bytes, just save the binary data
+        save_binary(bb, (const char*) &x[0], sizeof(T)*n);
+    }
+
+    template<class Buffer, class T>
+    void                load_array(Buffer& bb, T* x, size_t n)
+    {
+      if (!is_bitwise<T>::value)
+        for (size_t i = 0; i < n; ++i)
+          Serialization<T>::load(bb, x[i]);
+      else      // if the elements are plain bytes, just load the binary data
+        load_binary(bb, (char*) &x[0], sizeof(T)*n);
+    }
+  }
+
+  namespace detail
+  {
+    // Number of bytes diy::save(bb, x) writes, if it can be found without traversing x (0 otherwise):
+    // for types saved as plain bytes and for vectors of them. Cheap enough to size every enqueue;
+    // serialized_size() is exact for any type, but costs as much as saving.
+    template<class T>
+    struct quick_size
+    {
+      static size_t     size(const T&)                              { return is_bitwise<T>::value ? sizeof(T) : 0; }
+    };
+
+    template<class U>
+    struct quick_size< std::vector<U> >
+    {
+      static size_t     size(const std::vector<U>& v)               { return is_bitwise<U>::value ? sizeof(size_t) + sizeof(U)*v.size() : 0; }
+    };
   }
 
   template<class T>
-  void                  load(BinaryBuffer& bb, T* x, size_t n)
+  void                  save(BinaryBuffer& bb, const T* x, size_t n)    { detail::save_array(bb, x, n); }
+
+  template<class T>
+  void                  load(BinaryBuffer& bb, T* x, size_t n)          { detail::load_array(bb, x, n); }
+
+  template<class T>
+  void                  save(MemoryBuffer& bb, const T* x, size_t n)    { detail::save_array(bb, x, n); }
+
+  template<class T>
+  void                  load(MemoryBuffer& bb, T* x, size_t n)          { detail::load_array(bb, x, n); }
+
+  namespace detail
   {
-    if (!detail::is_default< Serialization<T> >::value)
-      for (size_t i = 0; i < n; ++i)
-        diy::load(bb, x[i]);
-    else      // if Serialization is not specialized for U, just load the binary data
-      bb.load_binary((char*) &x[0], sizeof(T)*n);
+    template<typename T>
+    struct alignment_of
+    {
+        struct Padded { char c; T x; };
+        enum { value = sizeof(Padded) - sizeof(T) };
+    };
   }
 
+  //! A non-owning, read-only view of `n` consecutive values of type `T` stored in a buffer
+  //! (see `Master::Proxy::dequeue_view()`). \ingroup Serialization
+  template<class T>
+  struct ArrayView
+  {
+    typedef             const T*                const_iterator;
+
+                        ArrayView(const T* data = 0, size_t size = 0):
+                          data_(data), size_(size)                  {}
+
+    const T*            data() const                                { return data_; }
+    size_t              size() const                                { return size_; }
+    bool                empty() const                               { return size_ == 0; }
+
+    const T&            operator[](size_t i) const                  { return data_[i]; }
+    const_iterator      begin() const                               { return data_; }
+    const_iterator      end() const                                 { return data_ + size_; }
+
+    private:
+      const T*          data_;
+      size_t            size_;
+  };
+
 
   // save/load for MemoryBuffer
   template<>
   struct Serialization< MemoryBuffer >
   {
-    static void         save(BinaryBuffer& bb, const MemoryBuffer& x)
+    template<class Buffer>
+    static void         save(Buffer& bb, const MemoryBuffer& x)
     {
       diy::save(bb, x.position);
       diy::save(bb, x.buffer);
     }
 
-    static void         load(BinaryBuffer& bb, MemoryBuffer& x)
+    template<class Buffer>
+    static void         load(Buffer& bb, MemoryBuffer& x)
     {
       diy::load(bb, x.position);
       diy::load(bb, x.buffer);
@@ -172,14 +323,16 @@ namespace diy
   {
     typedef             std::vector<U>          Vector;
 
-    static void         save(BinaryBuffer& bb, const Vector& v)
+    template<class Buffer>
+    static void         save(Buffer& bb, const Vector& v)
     {
       size_t s = v.size();
       diy::save(bb, s);
       diy::save(bb, &v[0], v.size());
     }
 
-    static void         load(BinaryBuffer& bb, Vector& v)
+    template<class Buffer>
+    static void         load(Buffer& bb, Vector& v)
     {
       size_t s;
       diy::load(bb, s);
@@ -194,16 +347,28 @@ namespace diy
   {
     typedef             std::pair<X,Y>          Pair;
 
-    static void         save(BinaryBuffer& bb, const Pair& p)
+    template<class Buffer>
+    static void         save(Buffer& bb, const Pair& p)
     {
-      diy::save(bb, p.first);
-      diy::save(bb, p.second);
+      if (detail::is_bitwise<Pair>::value)
+        detail::save_array(bb, &p, 1);
+      else
+      {
+        diy::save(bb, p.first);
+        diy::save(bb, p.second);
+      }
     }
 
-    static void         load(BinaryBuffer& bb, Pair& p)
+    template<class Buffer>
+    static void         load(Buffer& bb, Pair& p)
     {
-      diy::load(bb, p.first);
-      diy::load(bb, p.second);
+      if (detail::is_bitwise<Pair>::value)
+        detail::load_array(bb, &p, 1);
+      else
+      {
+        diy::load(bb, p.first);
+        diy::load(bb, p.second);
+      }
     }
   };
 
@@ -213,7 +378,8 @@ namespace diy
   {
     typedef             std::map<K,V>           Map;
 
-    static void         save(BinaryBuffer& bb, const Map& m)
+    template<class Buffer>
+    static void         save(Buffer& bb, const Map& m)
     {
       size_t s = m.size();
       diy::save(bb, s);
@@ -221,15 +387,32 @@ namespace diy
         diy::save(bb, *it);
     }
 
-    static void         load(BinaryBuffer& bb, Map& m)
+    // replaces the contents of m; the keys arrive sorted, so each one goes in at the end in constant time,
+    // and in C++17 the nodes already in m are reused (together with any capacity inside their values)
+    template<class Buffer>
+    static void         load(Buffer& bb, Map& m)
     {
       size_t s;
       diy::load(bb, s);
+#if __cplusplus > 201402L           // C++17
+      Map old;
+      old.swap(m);
+      for (; s > 0 && !old.empty(); --s)
+      {
+        typename Map::node_type node = old.extract(old.begin());
+        diy::load(bb, node.key());
+        diy::load(bb, node.mapped());
+        m.insert(m.end(), std::move(node));
+      }
+#else
+      m.clear();
+#endif
       for (size_t i = 0; i < s; ++i)
       {
         K k;
         diy::load(bb, k);
-        diy::load(bb, m[k]);
+        typename Map::iterator it = m.insert(m.end(), typename Map::value_type(k, V()));
+        diy::load(bb, it->second);
       }
     }
   };
@@ -240,7 +423,8 @@ namespace diy
   {
     typedef             std::set<T>             Set;
 
-    static void         save(BinaryBuffer& bb, const Set& m)
+    template<class Buffer>
+    static void         save(Buffer& bb, const Set& m)
     {
       size_t s = m.size();
       diy::save(bb, s);
@@ -248,15 +432,29 @@ namespace diy
         diy::save(bb, *it);
     }
 
-    static void         load(BinaryBuffer& bb, Set& m)
+    // replaces the contents of m, the same way as for std::map
+    template<class Buffer>
+    static void         load(Buffer& bb, Set& m)
     {
       size_t s;
       diy::load(bb, s);
+#if __cplusplus > 201402L           // C++17
+      Set old;
+      old.swap(m);
+      for (; s > 0 && !old.empty(); --s)
+      {
+        typename Set::node_type node = old.extract(old.begin());
+        diy::load(bb, node.value());
+        m.insert(m.end(), std::move(node));
+      }
+#else
+      m.clear();
+#endif
       for (size_t i = 0; i < s; ++i)
       {
         T p;
         diy::load(bb, p);
-        m.insert(p);
+        m.insert(m.end(), p);
       }
     }
   };
@@ -268,7 +466,8 @@ namespace diy
   {
     typedef             std::unordered_map<K,V>         Map;
 
-    static void         save(BinaryBuffer& bb, const Map& m)
+    template<class Buffer>
+    static void         save(Buffer& bb, const Map& m)
     {
       size_t s = m.size();
       diy::save(bb, s);
@@ -276,10 +475,27 @@ namespace diy
         diy::save(bb, x);
     }
 
-    static void         load(BinaryBuffer& bb, Map& m)
+    // replaces the contents of m with a single allocation for the buckets; in C++17 the nodes already in m are reused
+    template<class Buffer>
+    static void         load(Buffer& bb, Map& m)
     {
       size_t s;
       diy::load(bb, s);
+#if __cplusplus > 201402L           // C++17
+      Map old;
+      old.swap(m);
+      m.reserve(s);
+      for (; s > 0 && !old.empty(); --s)
+      {
+        typename Map::node_type node = old.extract(old.begin());
+        diy::load(bb, node.key());
+        diy::load(bb, node.mapped());
+        m.insert(std::move(node));
+      }
+#else
+      m.clear();
+      m.reserve(s);
+#endif
       for (size_t i = 0; i < s; ++i)
       {
         std::pair<K,V> p;
@@ -289,39 +505,52 @@ namespace diy
     }
   };
 
-  // save/load for std::tuple<...>
-  // TODO: this ought to be default (copying) serialization
-  //       if all arguments are default
+  // save/load for std::tuple<...>, element by element, in order
   template<class... Args>
   struct Serialization< std::tuple<Args...> >
   {
     typedef             std::tuple<Args...>     Tuple;
 
-    static void         save(BinaryBuffer& bb, const Tuple& t)          { save<0>(bb, t); }
+    template<class Buffer>
+    static void         save(Buffer& bb, const Tuple& t)                { save_from<0>(bb, t); }
 
-    template<std::size_t I = 0>
+    template<std::size_t I, class Buffer>
     static
     typename std::enable_if<I == sizeof...(Args), void>::type
-                        save(BinaryBuffer&, const Tuple&)               {}
+                        save_from(Buffer&, const Tuple&)                {}
 
-    template<std::size_t I = 0>
+    template<std::size_t I, class Buffer>
     static
     typename std::enable_if<I < sizeof...(Args), void>::type
-                        save(BinaryBuffer& bb, const Tuple& t)          { diy::save(bb, std::get<I>(t)); save<I+1>(bb, t); }
+                        save_from(Buffer& bb, const Tuple& t)           { diy::save(bb, std::get<I>(t)); save_from<I+1>(bb, t); }
 
-    static void         load(BinaryBuffer& bb, Tuple& t)                { load<0>(bb, t); }
+    template<class Buffer>
+    static void         load(Buffer& bb, Tuple& t)                      { load_from<0>(bb, t); }
 
-    template<std::size_t I = 0>
+    template<std::size_t I, class Buffer>
     static
     typename std::enable_if<I == sizeof...(Args), void>::type
-                        load(BinaryBuffer&, Tuple&)                     {}
+                        load_from(Buffer&, Tuple&)                      {}
 
-    template<std::size_t I = 0>
+    template<std::size_t I, class Buffer>
     static
     typename std::enable_if<I < sizeof...(Args), void>::type
-                        load(BinaryBuffer& bb, Tuple& t)                { diy::load(bb, std::get<I>(t)); load<I+1>(bb, t); }
+                        load_from(Buffer& bb, Tuple& t)                 { diy::load(bb, std::get<I>(t)); load_from<I+1>(bb, t); }
 
   };
+
+  // save/load for std::array<U,N>
+  template<class U, std::size_t N>
+  struct Serialization< std::array<U,N> >
+  {
+    typedef             std::array<U,N>         Array;
+
+    template<class Buffer>
+    static void         save(Buffer& bb, const Array& a)                { detail::save_array(bb, a.data(), N); }
+
+    template<class Buffer>
+    static void         load(Buffer& bb, Array& a)                      { detail::load_array(bb, a.data(), N); }
+  };
 #endif
 }
 
@@ -332,13 +561,26 @@ save_binary(const char* x, size_t count)
   if (position + count > buffer.capacity())
     buffer.reserve((position + count) * growth_multiplier());           // if we have to grow, grow geometrically
 
-  if (position + count > buffer.size())
-    buffer.resize(position + count);
-
-  std::copy(x, x + count, &buffer[position]);
+  if (position == buffer.size())
+    buffer.insert(buffer.end(), x, x + count);                          // appending: no need to zero-fill first
+  else
+  {
+    if (position + count > buffer.size())
+      buffer.resize(position + count);
+    std::copy(x, x + count, &buffer[position]);
+  }
   position += count;
 }
 
+void
+diy::MemoryBuffer::
+reserve_more(size_t count)
+{
+  // exactly, if the buffer is empty; otherwise at least geometrically, so that repeated calls stay cheap
+  if (position + count > buffer.capacity())
+    buffer.reserve(std::max(position + count, (size_t) (buffer.capacity() * growth_multiplier())));
+}
+
 void
 diy::MemoryBuffer::
 load_binary(char* x, size_t count)
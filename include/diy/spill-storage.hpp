@@ -0,0 +1,625 @@
+#ifndef DIY_SPILL_STORAGE_HPP
+#define DIY_SPILL_STORAGE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <cstdlib>      // mkstemp(), posix_memalign()
+#include <fcntl.h>
+
+#include "storage.hpp"
+#include "serialization.hpp"
+#include "critical-resource.hpp"
+#include "detail/placement.hpp"
+
+namespace diy
+{
+  namespace detail
+  {
+    inline void     pwrite_all(int fd, const char* x, size_t count, off_t offset)
+    {
+      while (count > 0)
+      {
+        ssize_t written = pwrite(fd, x, count, offset);
+        if (written < 0 && errno == EINTR)
+          continue;
+        if (written <= 0)
+          throw std::runtime_error(std::string("diy::SpillStorage: could not write: ") + std::strerror(errno));
+        x += written; count -= written; offset += written;
+      }
+    }
+
+    inline void     pread_all(int fd, char* x, size_t count, off_t offset)
+    {
+      while (count > 0)
+      {
+        ssize_t bytes = pread(fd, x, count, offset);
+        if (bytes < 0 && errno == EINTR)
+          continue;
+        if (bytes <= 0)
+          throw std::runtime_error(std::string("diy::SpillStorage: could not read: ") + std::strerror(errno));
+        x += bytes; count -= bytes; offset += bytes;
+      }
+    }
+
+    // Buffered writes and reads of one record, `size` bytes at `start` in the file.
+    struct ExtentBuffer: public BinaryBuffer
+    {
+                          ExtentBuffer(int fd_, off_t start_, size_t size_):
+                            fd(fd_), start(start_), size(size_), head(0), tail(0), begin(0)     {}
+
+      virtual inline void save_binary(const char* x, size_t count);
+      virtual inline void load_binary(char* x, size_t count);
+      virtual inline void load_binary_back(char* x, size_t count);
+
+      inline void         flush();
+
+      static const size_t chunk = 1 << 16;
+
+      int                 fd;
+      off_t               start;
+      size_t              size;
+      size_t              head, tail;       // bytes consumed from the front and from the back
+      size_t              begin;            // position in the record of buffer[0]
+      std::vector<char>   buffer;           // unwritten or prefetched bytes
+    };
+  }
+
+  //! External storage that appends records to one large file per filename template (see FileStorage),
+  //! instead of creating, syncing, and removing a file for every record; with several templates, each record
+  //! goes to the file where detail::Placement chooses, as in FileStorage. An in-memory index maps
+  //! records to their extents; the extents of records that are read back or destroyed are reused for
+  //! new ones, and the files are compacted when at least half of their space is free. Nothing is synced: the files
+  //! are unlinked as soon as they are created and only ever read back by the same process.
+  //! With `direct`, the files are opened with O_DIRECT (where available), bypassing the page cache;
+  //! records are then staged in aligned buffers.
+  class SpillStorage: public ExternalStorage
+  {
+    public:
+                    SpillStorage(const std::string& filename_template = "/tmp/DIY.XXXXXX",
+                                 bool direct = false):
+                      filename_templates_(1, filename_template), direct_(direct),
+                      placement_(filename_templates_)                                           {}
+
+                    SpillStorage(const std::vector<std::string>& filename_templates,
+                                 bool direct = false):
+                      filename_templates_(filename_templates), direct_(direct),
+                      placement_(filename_templates_)                                           {}
+
+      inline        ~SpillStorage();
+
+      virtual inline int    put(MemoryBuffer& bb);
+      virtual inline int    put(const void* x, detail::Save save);
+      virtual inline void   get(int i, MemoryBuffer& bb, size_t extra = 0);
+      virtual inline void   get(int i, void* x, detail::Load load);
+      virtual inline void   destroy(int i);
+
+      //! moves the records to the front of their files and shrinks the files; does nothing while a record is being read or written
+      inline void   compact();
+
+      int           count() const               { return state_.const_access()->count; }
+      size_t        current_size() const        { return state_.const_access()->current_size; }
+      size_t        max_size() const            { return state_.const_access()->max_size; }
+      inline size_t file_size() const;          //!< total size of the files, including free space
+
+    private:
+      struct Extent
+      {
+        int             file;
+        size_t          offset;
+        size_t          size;           // of the record
+        size_t          capacity;       // allocated (size rounded up to the alignment)
+      };
+
+      struct SpillFile
+      {
+                        SpillFile(): fd(-1), end(0), free(0), alignment(64)     {}
+
+        int             fd;
+        size_t          end;            // of the used part of the file
+        size_t          free;           // bytes in holes
+        size_t          alignment;      // of the extents (the block size with O_DIRECT)
+        bool            direct;
+        std::map<size_t, size_t>        holes;      // offset -> size
+        std::multimap<size_t, size_t>   by_size;    // size   -> offset
+      };
+
+      struct State
+      {
+                        State(): count(0), current_size(0), max_size(0), active(0)     {}
+
+        std::map<int, Extent>   records;
+        std::vector<SpillFile>  files;
+        int                     count;
+        size_t                  current_size, max_size;
+        int                     active;         // reads and writes in progress
+      };
+      typedef       critical_resource<State>        CriticalState;
+
+      inline Extent allocate(size_t size);
+      inline void   release(const Extent& e);   // also ends the read or write of e
+      inline void   insert(int i, const Extent& e);
+      inline Extent extract(int i);
+
+      inline void   open_files(State& state) const;
+      inline void   add_hole(SpillFile& f, size_t offset, size_t size) const;
+      inline void   remove_hole(SpillFile& f, std::map<size_t, size_t>::iterator it) const;
+      inline bool   fragmented(const SpillFile& f) const;
+      inline void   compact(State& state, int file) const;
+
+      struct AlignedBuffer
+      {
+                        AlignedBuffer(size_t size, size_t alignment)
+        {
+          if (posix_memalign(reinterpret_cast<void**>(&data), alignment, size) != 0)
+            throw std::bad_alloc();
+        }
+                        ~AlignedBuffer()        { ::free(data); }
+        char*           data;
+      };
+
+      static const size_t   compact_threshold = 1 << 24;       // don't bother compacting files with less free space
+
+    private:
+      std::vector<std::string>      filename_templates_;
+      bool                          direct_;
+      detail::Placement             placement_;
+      CriticalState                 state_;
+  };
+}
+
+void
+diy::detail::ExtentBuffer::
+save_binary(const char* x, size_t count)
+{
+  if (head + count > size)
+    throw std::runtime_error("diy::SpillStorage: the record is larger than the space reserved for it");
+  if (buffer.size() + count > chunk)
+    flush();
+  if (count >= chunk)
+  {
+    pwrite_all(fd, x, count, start + head);
+    begin = head + count;
+  } else
+    buffer.insert(buffer.end(), x, x + count);
+  head += count;
+}
+
+void
+diy::detail::ExtentBuffer::
+flush()
+{
+  if (!buffer.empty())
+    pwrite_all(fd, &buffer[0], buffer.size(), start + begin);
+  begin += buffer.size();
+  buffer.clear();
+}
+
+void
+diy::detail::ExtentBuffer::
+load_binary(char* x, size_t count)
+{
+  if (head + count > size)
+    throw std::runtime_error("diy::SpillStorage: reading past the end of the record");
+  size_t buffered = begin + buffer.size() - head;
+  if (count <= buffered)
+  {
+    std::memcpy(x, &buffer[head - begin], count);
+    head += count;
+    return;
+  }
+
+  // use up the buffer, then read directly or refill it
+  if (buffered > 0)
+    std::memcpy(x, &buffer[head - begin], buffered);
+  x += buffered; count -= buffered; head += buffered;
+  if (count >= chunk)
+  {
+    pread_all(fd, x, count, start + head);
+    head += count;
+    begin = head;
+    buffer.clear();
+  } else
+  {
+    buffer.resize(std::min(size_t(chunk), size - head));
+    pread_all(fd, &buffer[0], buffer.size(), start + head);
+    begin = head;
+    std::memcpy(x, &buffer[0], count);
+    head += count;
+  }
+}
+
+void
+diy::detail::ExtentBuffer::
+load_binary_back(char* x, size_t count)
+{
+  tail += count;
+  pread_all(fd, x, count, start + size - tail);
+}
+
+diy::SpillStorage::
+~SpillStorage()
+{
+  State& state = *state_.access();
+  for (size_t i = 0; i < state.files.size(); ++i)
+    close(state.files[i].fd);
+}
+
+int
+diy::SpillStorage::
+put(MemoryBuffer& bb)
+{
+  size_t size = bb.size();
+  Extent e    = allocate(size);
+  if (size > 0)
+  {
+    bool    direct;
+    int     fd;
+    size_t  alignment;
+    {
+      CriticalState::accessor state = state_.access();
+      direct    = state->files[e.file].direct;
+      fd        = state->files[e.file].fd;
+      alignment = state->files[e.file].alignment;
+    }
+    double start = detail::Placement::now();
+    if (direct)
+    {
+      AlignedBuffer staged(e.capacity, alignment);
+      std::memcpy(staged.data, &bb.buffer[0], size);
+      std::memset(staged.data + size, 0, e.capacity - size);
+      detail::pwrite_all(fd, staged.data, e.capacity, e.offset);
+    } else
+      detail::pwrite_all(fd, &bb.buffer[0], size, e.offset);
+    placement_.finish(e.file, size, detail::Placement::now() - start);
+  } else
+    placement_.finish(e.file, 0);
+  bb.wipe();
+
+  int i = (*state_.access()).count++;
+  insert(i, e);
+  return i;
+}
+
+int
+diy::SpillStorage::
+put(const void* x, detail::Save save)
+{
+  if (direct_)
+  {
+    MemoryBuffer bb;
+    save(x, bb);
+    return put(bb);
+  }
+
+  CountingBuffer cb;
+  save(x, cb);
+
+  Extent e = allocate(cb.count);
+  int    fd;
+  {
+    CriticalState::accessor state = state_.access();
+    fd = state->files[e.file].fd;
+  }
+  double start = detail::Placement::now();
+  detail::ExtentBuffer eb(fd, e.offset, e.size);
+  save(x, eb);
+  eb.flush();
+  placement_.finish(e.file, e.size, detail::Placement::now() - start);
+
+  int i = (*state_.access()).count++;
+  insert(i, e);
+  return i;
+}
+
+void
+diy::SpillStorage::
+get(int i, MemoryBuffer& bb, size_t extra)
+{
+  Extent e = extract(i);
+
+  bool    direct;
+  int     fd;
+  size_t  alignment;
+  {
+    CriticalState::accessor state = state_.access();
+    direct    = state->files[e.file].direct;
+    fd        = state->files[e.file].fd;
+    alignment = state->files[e.file].alignment;
+  }
+
+  bb.clear();
+  bb.buffer.reserve(e.size + extra);
+  bb.buffer.resize(e.size);
+  if (e.size > 0)
+  {
+    placement_.start(e.file);
+    double start = detail::Placement::now();
+    if (direct)
+    {
+      AlignedBuffer staged(e.capacity, alignment);
+      detail::pread_all(fd, staged.data, e.capacity, e.offset);
+      std::memcpy(&bb.buffer[0], staged.data, e.size);
+    } else
+      detail::pread_all(fd, &bb.buffer[0], e.size, e.offset);
+    placement_.finish(e.file, e.size, detail::Placement::now() - start);
+  }
+
+  release(e);
+}
+
+void
+diy::SpillStorage::
+get(int i, void* x, detail::Load load)
+{
+  if (direct_)
+  {
+    MemoryBuffer bb;
+    get(i, bb);
+    load(x, bb);
+    return;
+  }
+
+  Extent e = extract(i);
+  int    fd;
+  {
+    CriticalState::accessor state = state_.access();
+    fd = state->files[e.file].fd;
+  }
+  placement_.start(e.file);
+  double start = detail::Placement::now();
+  detail::ExtentBuffer eb(fd, e.offset, e.size);
+  load(x, eb);
+  placement_.finish(e.file, e.size, detail::Placement::now() - start);
+
+  release(e);
+}
+
+void
+diy::SpillStorage::
+destroy(int i)
+{
+  Extent e = extract(i);
+  release(e);
+}
+
+size_t
+diy::SpillStorage::
+file_size() const
+{
+  CriticalState::const_accessor state = state_.const_access();
+  size_t total = 0;
+  for (size_t i = 0; i < state->files.size(); ++i)
+    total += state->files[i].end;
+  return total;
+}
+
+diy::SpillStorage::Extent
+diy::SpillStorage::
+allocate(size_t size)
+{
+  CriticalState::accessor state = state_.access();
+  open_files(*state);
+
+  Extent e;
+  e.file      = placement_.choose(size);          // starts the write
+  e.size      = size;
+
+  SpillFile& f = state->files[e.file];
+  e.capacity  = (size + f.alignment - 1) / f.alignment * f.alignment;
+
+  // best fit among the holes, or the end of the file
+  std::multimap<size_t, size_t>::iterator it = f.by_size.lower_bound(e.capacity);
+  if (e.capacity > 0 && it != f.by_size.end())
+  {
+    e.offset         = it->second;
+    size_t hole_size = it->first;
+    remove_hole(f, f.holes.find(e.offset));
+    if (hole_size > e.capacity)
+      add_hole(f, e.offset + e.capacity, hole_size - e.capacity);
+  } else
+  {
+    e.offset  = f.end;
+    f.end    += e.capacity;
+  }
+
+  ++state->active;
+  return e;
+}
+
+void
+diy::SpillStorage::
+insert(int i, const Extent& e)
+{
+  CriticalState::accessor state = state_.access();
+  state->records[i] = e;
+  --state->active;
+
+  state->current_size += e.size;
+  if (state->current_size > state->max_size)
+    state->max_size = state->current_size;
+}
+
+diy::SpillStorage::Extent
+diy::SpillStorage::
+extract(int i)
+{
+  CriticalState::accessor state = state_.access();
+  std::map<int, Extent>::iterator it = state->records.find(i);
+  Extent e = it->second;
+  state->records.erase(it);
+  state->current_size -= e.size;
+  ++state->active;
+  return e;
+}
+
+void
+diy::SpillStorage::
+release(const Extent& e)
+{
+  CriticalState::accessor state = state_.access();
+  --state->active;
+
+  SpillFile& f = state->files[e.file];
+  if (e.capacity > 0)
+    add_hole(f, e.offset, e.capacity);
+
+  // the space at the end goes back to the file system
+  std::map<size_t, size_t>::iterator last = f.holes.end();
+  if (!f.holes.empty() && (--last)->first + last->second == f.end)
+  {
+    f.end = last->first;
+    remove_hole(f, last);
+    if (ftruncate(f.fd, f.end) != 0)
+      fprintf(stderr, "Warning: could not truncate a spill file: %s\n", std::strerror(errno));
+  }
+
+  if (state->active == 0 && fragmented(f))
+    compact(*state, e.file);
+}
+
+void
+diy::SpillStorage::
+compact()
+{
+  CriticalState::accessor state = state_.access();
+  if (state->active > 0)
+    return;
+  for (size_t i = 0; i < state->files.size(); ++i)
+    if (state->files[i].free > 0)
+      compact(*state, i);
+}
+
+void
+diy::SpillStorage::
+compact(State& state, int file) const
+{
+  SpillFile& f = state.files[file];
+
+  std::vector< std::pair<size_t, Extent*> > extents;       // (offset, extent) of the records in the file
+  for (std::map<int, Extent>::iterator it = state.records.begin(); it != state.records.end(); ++it)
+    if (it->second.file == file)
+      extents.push_back(std::make_pair(it->second.offset, &it->second));
+  std::sort(extents.begin(), extents.end());
+
+  // slide the records down; copying forward is safe, since every record moves to a lower offset
+  AlignedBuffer   chunk(detail::ExtentBuffer::chunk, f.alignment);
+  size_t          end = 0;
+  for (size_t i = 0; i < extents.size(); ++i)
+  {
+    Extent& e = *extents[i].second;
+    if (e.offset != end)
+    {
+      size_t size = f.direct ? e.capacity : e.size;         // only O_DIRECT writes the padding
+      for (size_t moved = 0; moved < size; moved += detail::ExtentBuffer::chunk)
+      {
+        size_t count = std::min(size_t(detail::ExtentBuffer::chunk), size - moved);
+        detail::pread_all (f.fd, chunk.data, count, e.offset + moved);
+        detail::pwrite_all(f.fd, chunk.data, count, end + moved);
+      }
+    }
+    e.offset = end;
+    end     += e.capacity;
+  }
+
+  f.end   = end;
+  f.free  = 0;
+  f.holes.clear();
+  f.by_size.clear();
+  if (ftruncate(f.fd, f.end) != 0)
+    fprintf(stderr, "Warning: could not truncate a spill file: %s\n", std::strerror(errno));
+}
+
+void
+diy::SpillStorage::
+open_files(State& state) const
+{
+  if (!state.files.empty())
+    return;
+
+  state.files.resize(filename_templates_.size());
+  for (size_t i = 0; i < filename_templates_.size(); ++i)
+  {
+    SpillFile&          f = state.files[i];
+    std::vector<char>   filename(filename_templates_[i].begin(), filename_templates_[i].end());
+    filename.push_back(0);
+    std::vector<char>   name = filename;
+
+    f.direct = false;
+#if defined(O_DIRECT) && !defined(__MACH__)
+    if (direct_)
+    {
+      f.fd = mkostemp(&name[0], O_DIRECT);
+      if (f.fd >= 0)
+      {
+        f.direct    = true;
+        f.alignment = 4096;
+      } else
+      {
+        fprintf(stderr, "Warning: could not open %s with O_DIRECT (%s); falling back to buffered I/O\n", &filename[0], std::strerror(errno));
+        name = filename;
+      }
+    }
+#endif
+    if (!f.direct)
+      f.fd = mkstemp(&name[0]);
+    if (f.fd < 0)
+      throw std::runtime_error(std::string("diy::SpillStorage: could not create ") + &filename[0] + ": " + std::strerror(errno));
+    unlink(&name[0]);           // the space is reclaimed when the file is closed
+  }
+}
+
+void
+diy::SpillStorage::
+add_hole(SpillFile& f, size_t offset, size_t size) const
+{
+  // merge with the neighbors
+  std::map<size_t, size_t>::iterator next = f.holes.lower_bound(offset);
+  if (next != f.holes.end() && offset + size == next->first)
+  {
+    size += next->second;
+    remove_hole(f, next);
+  }
+  std::map<size_t, size_t>::iterator prev = f.holes.lower_bound(offset);
+  if (prev != f.holes.begin() && (--prev)->first + prev->second == offset)
+  {
+    offset  = prev->first;
+    size   += prev->second;
+    remove_hole(f, prev);
+  }
+
+  f.free         += size;
+  f.holes[offset]  = size;
+  f.by_size.insert(std::make_pair(size, offset));
+}
+
+void
+diy::SpillStorage::
+remove_hole(SpillFile& f, std::map<size_t, size_t>::iterator it) const
+{
+  std::pair<std::multimap<size_t, size_t>::iterator,
+            std::multimap<size_t, size_t>::iterator> range = f.by_size.equal_range(it->second);
+  for (std::multimap<size_t, size_t>::iterator s = range.first; s != range.second; ++s)
+    if (s->second == it->first)
+    {
+      f.by_size.erase(s);
+      break;
+    }
+  f.free -= it->second;
+  f.holes.erase(it);
+}
+
+bool
+diy::SpillStorage::
+fragmented(const SpillFile& f) const
+{
+  return f.free >= compact_threshold && f.free >= f.end / 2;
+}
+
+#endif
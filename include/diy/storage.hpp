@@ -11,7 +11,9 @@
 #include <fcntl.h>
 
 #include "serialization.hpp"
+#include "compression.hpp"
 #include "thread.hpp"
+#include "detail/placement.hpp"
 
 namespace diy
 {
@@ -25,7 +27,7 @@ namespace diy
                           FileBuffer(FILE* file_): file(file_), head(0), tail(0)    {}
 
       // TODO: add error checking
-      virtual inline void save_binary(const char* x, size_t count)    { fwrite(x, 1, count, file); head += count; }
+      virtual inline void save_binary(const char* x, size_t count)    { head += fwrite(x, 1, count, file); }
       virtual inline void load_binary(char* x, size_t count)          { fread(x, 1, count, file); }
       virtual inline void load_binary_back(char* x, size_t count)     { fseek(file, tail, SEEK_END); fread(x, 1, count, file); tail += count; fseek(file, head, SEEK_SET); }
 
@@ -52,32 +54,75 @@ namespace diy
     private:
       struct FileRecord
       {
-        size_t          size;
+        size_t          size;           // in the file
         std::string     name;
+        size_t          original;       // size before compression, or 0 if the record is not compressed
+        const Codec*    codec;          // that compressed the record (compression may have been changed since)
+        int             target;         // index of the filename template
       };
 
     public:
                     FileStorage(const std::string& filename_template = "/tmp/DIY.XXXXXX"):
                       filename_templates_(1, filename_template),
-                      count_(0), current_size_(0), max_size_(0)         {}
+                      placement_(filename_templates_),
+                      count_(0), current_size_(0), max_size_(0),
+                      codec_(0), codec_threshold_(0)                    {}
 
+                    //! with several templates (e.g., in directories on different devices), each record goes
+                    //! to the fastest directory with room for it, that isn't busy (see detail::Placement)
                     FileStorage(const std::vector<std::string>& filename_templates):
                       filename_templates_(filename_templates),
-                      count_(0), current_size_(0), max_size_(0)         {}
+                      placement_(filename_templates_),
+                      count_(0), current_size_(0), max_size_(0),
+                      codec_(0), codec_threshold_(0)                    {}
+
+      //! compress the records of at least `threshold` bytes with `codec` (0 turns compression off);
+      //! blocks are then serialized in memory first, instead of straight into the file; the records
+      //! already stored are read back with the codec that compressed them, which must outlive them
+      void          set_compression(const Codec* codec, size_t threshold = 4096)    { codec_ = codec; codec_threshold_ = threshold; }
+      const Codec*  compression() const                                             { return codec_; }
 
       virtual int   put(MemoryBuffer& bb)
       {
-        std::string     filename;
-        int fh = open_random(filename);
-
-        //fprintf(stdout, "FileStorage::put(): %s; buffer size: %lu\n", filename.c_str(), bb.size());
+        size_t original = 0;
+        if (codec_ && bb.size() >= codec_threshold_ && !bb.empty())
+        {
+          std::vector<char> compressed;
+          codec_->compress(&bb.buffer[0], bb.size(), compressed);
+          if (compressed.size() < bb.size())
+          {
+            original = bb.size();
+            bb.buffer.swap(compressed);
+          }
+        }
 
-        size_t sz = bb.buffer.size();
-        size_t written = write(fh, &bb.buffer[0], sz);
-        if (written < sz || written == -1)
-          fprintf(stderr, "Warning: could not write the full buffer to %s: written = %lu; size = %lu\n", filename.c_str(), written, sz);
-        fsync(fh);
-        close(fh);
+        size_t          sz = bb.buffer.size();
+        std::string     filename;
+        int             target;
+        for (size_t attempt = 0; ; ++attempt)
+        {
+          int fh = open_random(filename, sz, target);
+
+          //fprintf(stdout, "FileStorage::put(): %s; buffer size: %lu\n", filename.c_str(), bb.size());
+
+          double  start   = detail::Placement::now();
+          ssize_t written = write(fh, &bb.buffer[0], sz);
+          fsync(fh);
+          close(fh);
+          placement_.finish(target, sz, detail::Placement::now() - start);
+          if (written == (ssize_t) sz)
+            break;
+
+          if (attempt + 1 < placement_.size())
+          {
+            // out of space, most likely: try another directory
+            placement_.full(target);
+            remove(filename.c_str());
+            continue;
+          }
+          fprintf(stderr, "Warning: could not write the full buffer to %s: written = %ld; size = %lu\n", filename.c_str(), (long) written, sz);
+          break;
+        }
         bb.wipe();
 
 #if 0       // double-check the written file size: only for extreme debugging
@@ -89,21 +134,53 @@ namespace diy
         fclose(fp);
 #endif
 
-        return make_file_record(filename, sz);
+        return make_file_record(filename, sz, original, original ? codec_ : 0, target);
       }
 
       virtual int    put(const void* x, detail::Save save)
       {
-        std::string     filename;
-        int fh = open_random(filename);
+        if (codec_)
+        {
+          MemoryBuffer bb;
+          save(x, bb);
+          return put(bb);
+        }
 
-        detail::FileBuffer fb(fdopen(fh, "w"));
-        save(x, fb);
-        size_t sz = fb.size();
-        fclose(fb.file);
-        fsync(fh);
+        CountingBuffer  cb;             // size it first, so that placement_ knows how much room it needs
+        save(x, cb);
+
+        size_t          sz = cb.count;
+        std::string     filename;
+        int             target;
+        for (size_t attempt = 0; ; ++attempt)
+        {
+          int fh = open_random(filename, sz, target);
+
+          double start = detail::Placement::now();
+          detail::FileBuffer fb(fdopen(fh, "w"));
+          save(x, fb);
+          size_t written = fb.size();
+          if (fflush(fb.file) != 0)
+            written = 0;
+          fsync(fh);
+          if (fclose(fb.file) != 0)
+            written = 0;
+          placement_.finish(target, sz, detail::Placement::now() - start);
+          if (written == sz)
+            break;
+
+          if (attempt + 1 < placement_.size())
+          {
+            // out of space, most likely: try another directory
+            placement_.full(target);
+            remove(filename.c_str());
+            continue;
+          }
+          fprintf(stderr, "Warning: could not write the full record to %s: written = %lu; size = %lu\n", filename.c_str(), written, sz);
+          break;
+        }
 
-        return make_file_record(filename, sz);
+        return make_file_record(filename, sz, 0, 0, target);
       }
 
       virtual void   get(int i, MemoryBuffer& bb, size_t extra)
@@ -112,24 +189,53 @@ namespace diy
 
         //fprintf(stdout, "FileStorage::get(): %s\n", fr.name.c_str());
 
-        bb.buffer.reserve(fr.size + extra);
-        bb.buffer.resize(fr.size);
+        std::vector<char> compressed;
+        std::vector<char>& in = fr.original ? compressed : bb.buffer;
+        if (!fr.original)
+          in.reserve(fr.size + extra);
+        in.resize(fr.size);
+        placement_.start(fr.target);
+        double start = detail::Placement::now();
         int fh = open(fr.name.c_str(), O_RDONLY | O_SYNC, 0600);
-        read(fh, &bb.buffer[0], fr.size);
+        read(fh, &in[0], fr.size);
         close(fh);
+        placement_.finish(fr.target, fr.size, detail::Placement::now() - start);
+
+        if (fr.original)
+        {
+          bb.buffer.reserve(fr.original + extra);
+          bb.buffer.resize(fr.original);
+          fr.codec->decompress(&compressed[0], compressed.size(), &bb.buffer[0], fr.original);
+        }
 
         remove_file(fr);
       }
 
       virtual void   get(int i, void* x, detail::Load load)
       {
+        bool compressed;
+        {
+          CriticalMapAccessor accessor = filenames_.access();
+          compressed = (*accessor)[i].original != 0;
+        }
+        if (compressed)
+        {
+          MemoryBuffer bb;
+          get(i, bb, 0);
+          load(x, bb);
+          return;
+        }
+
         FileRecord fr = extract_file_record(i);
 
+        placement_.start(fr.target);
+        double start = detail::Placement::now();
         //int fh = open(fr.name.c_str(), O_RDONLY | O_SYNC, 0600);
         int fh = open(fr.name.c_str(), O_RDONLY, 0600);
         detail::FileBuffer fb(fdopen(fh, "r"));
         load(x, fb);
         fclose(fb.file);
+        placement_.finish(fr.target, fr.size, detail::Placement::now() - start);
 
         remove_file(fr);
       }
@@ -161,15 +267,11 @@ namespace diy
       }
 
     private:
-      int           open_random(std::string& filename) const
+      // creates a file for a record of (about) `size` bytes, where placement_ chooses
+      int           open_random(std::string& filename, size_t size, int& target)
       {
-        if (filename_templates_.size() == 1)
-            filename = filename_templates_[0].c_str();
-        else
-        {
-            // pick a template at random (very basic load balancing mechanism)
-            filename  = filename_templates_[std::rand() % filename_templates_.size()].c_str();
-        }
+        target   = placement_.choose(size);
+        filename = filename_templates_[target].c_str();
 #ifdef __MACH__
         // TODO: figure out how to open with O_SYNC
         int fh = mkstemp(const_cast<char*>(filename.c_str()));
@@ -180,10 +282,10 @@ namespace diy
         return fh;
       }
 
-      int           make_file_record(const std::string& filename, size_t sz)
+      int           make_file_record(const std::string& filename, size_t sz, size_t original, const Codec* codec, int target)
       {
         int res = (*count_.access())++;
-        FileRecord  fr = { sz, filename };
+        FileRecord  fr = { sz, filename, original, codec, target };
         (*filenames_.access())[res] = fr;
 
         // keep track of sizes
@@ -217,9 +319,12 @@ namespace diy
 
     private:
       std::vector<std::string>      filename_templates_;
+      detail::Placement             placement_;
       CriticalMap                   filenames_;
       critical_resource<int>        count_;
       critical_resource<size_t>     current_size_, max_size_;
+      const Codec*                  codec_;
+      size_t                        codec_threshold_;
   };
 }
 
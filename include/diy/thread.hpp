@@ -14,6 +14,7 @@ namespace diy
   using tthread::fast_mutex;
   using tthread::recursive_mutex;
   using tthread::lock_guard;
+  using tthread::condition_variable;
   namespace this_thread = tthread::this_thread;
 }
 #endif
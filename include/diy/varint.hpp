@@ -0,0 +1,248 @@
+#ifndef DIY_VARINT_HPP
+#define DIY_VARINT_HPP
+
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+#include "serialization.hpp"
+
+namespace diy
+{
+  //!\addtogroup Serialization
+  //!@{
+
+  // Compact encoding of integers, for payloads dominated by gids, offsets, IDs, and counts. It's opt-in:
+  // the functions below have the signature of diy::save()/diy::load(), so they can be called directly
+  // or passed to Proxy::enqueue()/dequeue() in their place, e.g., cp.enqueue(to, ids, &diy::save_delta).
+  // Both sides must use the same encoding.
+
+  //! Saves an integer as a LEB128 varint: 7 bits per byte, so values below 128 take one byte;
+  //! signed values are zigzag-encoded first, so that small negative values are short too.
+  template<class T>
+  void                  save_varint(BinaryBuffer& bb, const T& x);
+
+  template<class T>
+  void                  load_varint(BinaryBuffer& bb, T& x);
+
+  //! Saves a vector of integers (and its size) as varints.
+  template<class T>
+  void                  save_varint(BinaryBuffer& bb, const std::vector<T>& v);
+
+  template<class T>
+  void                  load_varint(BinaryBuffer& bb, std::vector<T>& v);
+
+  //! Saves a vector of integers as varints of the differences between consecutive elements:
+  //! sorted sequences (e.g., particle IDs) shrink to a byte or two per element. Unsorted data still works.
+  template<class T>
+  void                  save_delta(BinaryBuffer& bb, const std::vector<T>& v);
+
+  template<class T>
+  void                  load_delta(BinaryBuffer& bb, std::vector<T>& v);
+
+  //@}
+
+  namespace detail
+  {
+    typedef     unsigned long long      varint_t;
+
+    template<class T>
+    varint_t            zigzag(T x)
+    {
+      if (T(-1) < T(0))     // signed
+        return (varint_t(x) << 1) ^ (x < T(0) ? ~varint_t(0) : varint_t(0));
+      else
+        return varint_t(x);
+    }
+
+    template<class T>
+    T                   unzigzag(varint_t v)
+    {
+      if (T(-1) < T(0))
+        return T((v >> 1) ^ (~(v & 1) + 1));
+      else
+        return T(v);
+    }
+
+    // encodes into a small local buffer, which is flushed to bb with a single save_binary()
+    struct VarintWriter
+    {
+                        VarintWriter(BinaryBuffer& bb_): bb(bb_), n(0)  {}
+                        ~VarintWriter()                                 { flush(); }
+
+      void              put(varint_t v)
+      {
+        if (n > sizeof(buffer) - 10)
+          flush();
+        while (v >= 0x80)
+        {
+          buffer[n++] = (unsigned char) (v | 0x80);
+          v >>= 7;
+        }
+        buffer[n++] = (unsigned char) v;
+      }
+
+      void              put_bytes(const void* x, size_t count)
+      {
+        if (n + count > sizeof(buffer))
+          flush();
+        if (count > sizeof(buffer))
+          bb.save_binary((const char*) x, count);
+        else
+        {
+          std::memcpy(buffer + n, x, count);
+          n += count;
+        }
+      }
+
+      void              flush()                                         { if (n) bb.save_binary((const char*) buffer, n); n = 0; }
+
+      BinaryBuffer&     bb;
+      unsigned char     buffer[1024];
+      size_t            n;
+    };
+
+    // decodes straight out of a MemoryBuffer; any other buffer is read a byte at a time
+    struct VarintReader
+    {
+                        VarintReader(BinaryBuffer& bb_): bb(bb_), mb(dynamic_cast<MemoryBuffer*>(&bb_))    {}
+
+      varint_t          get()
+      {
+        varint_t        v     = 0;
+        int             shift = 0;
+        unsigned char   c;
+        do
+        {
+          if (shift >= 64)      // more than 10 bytes: corrupt or truncated input
+            throw std::runtime_error("diy: malformed varint in the encoded data");
+          c = next();
+          v |= varint_t(c & 0x7f) << shift;
+          shift += 7;
+        } while (c & 0x80);
+        return v;
+      }
+
+      // the size of a sequence that takes at least a byte for every `per_byte` elements, after `header` bytes;
+      // out of a MemoryBuffer, it can't exceed the bytes left, so a corrupt size doesn't turn into a huge resize()
+      size_t            get_size(size_t per_byte = 1, size_t header = 0)
+      {
+        varint_t        n = get();
+        if (mb && n > 0)
+        {
+          size_t left = mb->position > mb->buffer.size() ? 0 : mb->buffer.size() - mb->position;
+          if (left < header || n / per_byte + (n % per_byte != 0) > left - header)
+            throw std::runtime_error("diy: the encoded size is larger than the data left in the buffer");
+        }
+        return n;
+      }
+
+      unsigned char     next()
+      {
+        if (mb)
+        {
+          check(1);
+          return mb->buffer[mb->position++];
+        }
+        char c;
+        bb.load_binary(&c, 1);
+        return c;
+      }
+
+      void              get_bytes(void* x, size_t count)
+      {
+        if (mb)
+        {
+          check(count);
+          std::memcpy(x, &mb->buffer[mb->position], count);
+          mb->position += count;
+        } else
+          bb.load_binary((char*) x, count);
+      }
+
+      // a truncated queue, or one read back with the wrong type, must not send us past the end
+      void              check(size_t count) const
+      {
+        if (mb->position > mb->buffer.size() || count > mb->buffer.size() - mb->position)
+          throw std::runtime_error("diy: reading encoded data past the end of the buffer");
+      }
+
+      BinaryBuffer&     bb;
+      MemoryBuffer*     mb;
+    };
+  }
+}
+
+template<class T>
+void
+diy::
+save_varint(BinaryBuffer& bb, const T& x)
+{
+  detail::VarintWriter  out(bb);
+  out.put(detail::zigzag(x));
+}
+
+template<class T>
+void
+diy::
+load_varint(BinaryBuffer& bb, T& x)
+{
+  detail::VarintReader  in(bb);
+  x = detail::unzigzag<T>(in.get());
+}
+
+template<class T>
+void
+diy::
+save_varint(BinaryBuffer& bb, const std::vector<T>& v)
+{
+  detail::VarintWriter  out(bb);
+  out.put(v.size());
+  for (size_t i = 0; i < v.size(); ++i)
+    out.put(detail::zigzag(v[i]));
+}
+
+template<class T>
+void
+diy::
+load_varint(BinaryBuffer& bb, std::vector<T>& v)
+{
+  detail::VarintReader  in(bb);
+  v.resize(in.get_size());
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = detail::unzigzag<T>(in.get());
+}
+
+template<class T>
+void
+diy::
+save_delta(BinaryBuffer& bb, const std::vector<T>& v)
+{
+  // differences are taken modulo 2^64 and zigzag-encoded, which works for any integer type and order
+  detail::VarintWriter  out(bb);
+  out.put(v.size());
+  detail::varint_t      prev = 0;
+  for (size_t i = 0; i < v.size(); ++i)
+  {
+    detail::varint_t    cur = detail::varint_t(v[i]);
+    out.put(detail::zigzag((long long) (cur - prev)));
+    prev = cur;
+  }
+}
+
+template<class T>
+void
+diy::
+load_delta(BinaryBuffer& bb, std::vector<T>& v)
+{
+  detail::VarintReader  in(bb);
+  v.resize(in.get_size());
+  detail::varint_t      prev = 0;
+  for (size_t i = 0; i < v.size(); ++i)
+  {
+    prev += detail::varint_t(detail::unzigzag<long long>(in.get()));
+    v[i]  = T(prev);
+  }
+}
+
+#endif